@@ -0,0 +1,203 @@
+#include "GeometryArena.hpp"
+
+#include "gl_errors.hpp"
+#include "Load.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <tuple>
+
+//(never destroyed, so MeshBuffers destroyed at exit can still hand their ranges back)
+static GeometryArena *arena = nullptr;
+
+//create the arena on the GL thread, before any (LoadTagDefault) loader uploads a MeshBuffer:
+static Load< void > create_arena("GeometryArena", LoadTagEarly, [](){
+	GeometryArena::create();
+});
+
+void GeometryArena::create() {
+	assert(!arena && "GeometryArena::create() should only be called once");
+	arena = new GeometryArena();
+}
+
+GeometryArena &GeometryArena::get() {
+	assert(arena && "GeometryArena::get() called before GeometryArena::create()");
+	return *arena;
+}
+
+void GeometryArena::delete_gl_objects() {
+	if (!arena) return;
+	for (auto &lv : arena->vaos) {
+		glDeleteVertexArrays(1, &lv.second);
+	}
+	arena->vaos.clear();
+	auto delete_buffer = [](Pool &pool) {
+		if (pool.buffer) glDeleteBuffers(1, &pool.buffer);
+		pool.buffer = 0;
+	};
+	for (auto &sp : arena->vertex_pools) {
+		delete_buffer(sp.second);
+	}
+	delete_buffer(arena->index_pool);
+	GL_ERRORS();
+}
+
+GeometryArena::GeometryArena() {
+	index_pool.unit = IndexUnit;
+	grow(index_pool, 0);
+}
+
+bool GeometryArena::Layout::operator<(Layout const &other) const {
+	auto key = [](Binding const &b) {
+		return std::make_tuple(b.location, b.size, b.type, b.normalized, b.offset);
+	};
+	if (stride != other.stride) return stride < other.stride;
+	return std::lexicographical_compare(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(),
+		[&key](Binding const &a, Binding const &b) { return key(a) < key(b); });
+}
+
+GeometryArena::Range GeometryArena::add_vertices(GLsizei vertex_size, size_t count, void const *data) {
+	assert(vertex_size > 0);
+	return allocate(vertex_pool(vertex_size), count, data);
+}
+
+GeometryArena::Range GeometryArena::add_indices(size_t bytes, void const *data) {
+	//(the last unit may be partly filled; allocate() copies only 'bytes')
+	Range range = allocate(index_pool, (bytes + IndexUnit - 1) / IndexUnit, nullptr);
+	if (range.pool) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, index_pool.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, range.begin * IndexUnit, bytes, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return range;
+}
+
+void GeometryArena::remove(Range *range_) {
+	assert(range_);
+	Range &range = *range_;
+	if (!range.pool) return;
+	Pool &pool = *range.pool;
+	assert(range.begin + range.count <= pool.capacity);
+
+	//add to the free list, merging with free neighbors:
+	size_t begin = range.begin;
+	size_t count = range.count;
+	auto after = pool.free.lower_bound(begin);
+	assert(after == pool.free.end() || after->first >= begin + count); //(not already free)
+	if (after != pool.free.end() && after->first == begin + count) {
+		count += after->second;
+		after = pool.free.erase(after);
+	}
+	if (after != pool.free.begin()) {
+		auto before = std::prev(after);
+		assert(before->first + before->second <= begin); //(not already free)
+		if (before->first + before->second == begin) {
+			before->second += count;
+			range = Range();
+			return;
+		}
+	}
+	pool.free.emplace(begin, count);
+	range = Range();
+}
+
+GLuint GeometryArena::vao_for(Layout const &layout) {
+	auto f = vaos.find(layout);
+	if (f != vaos.end()) return f->second;
+
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	vaos.emplace(layout, vao);
+	bind_vao(vao, layout);
+	return vao;
+}
+
+GeometryArena::Pool &GeometryArena::vertex_pool(GLsizei vertex_size) {
+	auto f = vertex_pools.find(vertex_size);
+	if (f != vertex_pools.end()) return f->second;
+
+	Pool &pool = vertex_pools[vertex_size];
+	pool.unit = size_t(vertex_size);
+	grow(pool, 0);
+	return pool;
+}
+
+GeometryArena::Range GeometryArena::allocate(Pool &pool, size_t count, void const *data) {
+	if (count == 0) return Range();
+
+	//first fit:
+	auto f = std::find_if(pool.free.begin(), pool.free.end(), [count](std::pair< const size_t, size_t > const &free) {
+		return free.second >= count;
+	});
+	if (f == pool.free.end()) {
+		grow(pool, count);
+		f = std::prev(pool.free.end()); //(growing leaves a large enough free range at the end)
+		assert(f->second >= count);
+	}
+
+	Range range;
+	range.pool = &pool;
+	range.begin = f->first;
+	range.count = count;
+	if (f->second > count) pool.free.emplace(f->first + count, f->second - count);
+	pool.free.erase(f);
+
+	if (data) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, range.begin * pool.unit, range.count * pool.unit, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return range;
+}
+
+void GeometryArena::grow(Pool &pool, size_t count) {
+	//free space already at the end of the buffer counts toward 'count':
+	size_t tail = 0;
+	if (!pool.free.empty()) {
+		auto last = std::prev(pool.free.end());
+		if (last->first + last->second == pool.capacity) tail = last->second;
+	}
+	size_t capacity = std::max(pool.capacity * 2, (MinBytes + pool.unit - 1) / pool.unit);
+	while (capacity < pool.capacity + count - tail) capacity *= 2;
+
+	//copy into a new, larger buffer (through the copy targets, so no vertex array object's bindings change):
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * pool.unit, nullptr, GL_STATIC_DRAW);
+	if (pool.buffer) {
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.capacity * pool.unit);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &pool.buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	pool.buffer = buffer;
+
+	//the new space is free:
+	if (tail) std::prev(pool.free.end())->second += capacity - pool.capacity;
+	else pool.free.emplace(pool.capacity, capacity - pool.capacity);
+	pool.capacity = capacity;
+
+	//point vertex array objects at the new buffer:
+	for (auto const &lv : vaos) {
+		if (&pool == &index_pool || GLsizei(pool.unit) == lv.first.stride) {
+			bind_vao(lv.second, lv.first);
+		}
+	}
+
+	GL_ERRORS();
+}
+
+void GeometryArena::bind_vao(GLuint vao, Layout const &layout) {
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_pool(layout.stride).buffer);
+	for (auto const &b : layout.bindings) {
+		glVertexAttribPointer(b.location, b.size, b.type, b.normalized, layout.stride, (GLbyte *)0 + b.offset);
+		glEnableVertexAttribArray(b.location);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_pool.buffer); //(element buffer binding is part of the vao)
+	glBindVertexArray(0);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/*
+ * GeometryArena holds the vertices and element indices of every MeshBuffer in a few large OpenGL buffers:
+ *  one vertex buffer per vertex size, and one element buffer shared by everything. Each buffer is handed out
+ *  in ranges from a first-fit free list, and grows (by copying into a buffer twice the size) when no free range fits.
+ *
+ * Meshes are drawn by base vertex and element offset into these buffers, so one vertex array object per
+ *  vertex layout (and set of attribute locations) serves every mesh, whichever file it was loaded from,
+ *  and Scene::draw doesn't need to switch vertex array objects between meshes from different files.
+ *
+ * There is one arena (GeometryArena::get()), used only on the GL thread.
+ *  It is created (by GeometryArena::create()) by a LoadTagEarly loader, so on the GL thread and before any
+ *  LoadTagDefault loader can upload a MeshBuffer; get() never creates it.
+ *  It lives as long as the program (so MeshBuffers destroyed at exit can still hand their ranges back), but its
+ *  OpenGL objects -- buffers and cached vertex array objects -- are deleted by GeometryArena::delete_gl_objects(),
+ *  which the programs' main() functions call before deleting the context.
+ *
+ */
+
+#include "GL.hpp"
+
+#include <map>
+#include <vector>
+#include <cstddef>
+
+struct GeometryArena {
+	static void create(); //(makes OpenGL calls; called once, on the GL thread, by call_load_functions())
+	static GeometryArena &get(); //(the arena must already exist)
+	//delete the arena's buffers and vertex array objects (if it was created), on the GL thread before the context goes away:
+	// (ranges can still be removed afterward, but nothing can be added or drawn)
+	static void delete_gl_objects();
+
+	GeometryArena(GeometryArena const &) = delete;
+	GeometryArena &operator=(GeometryArena const &) = delete;
+
+	struct Pool;
+
+	//A range of one of the arena's buffers, in that buffer's units (vertices, or IndexUnit bytes for the element buffer):
+	struct Range {
+		Pool *pool = nullptr; //nullptr for empty ranges
+		size_t begin = 0;
+		size_t count = 0;
+	};
+
+	//copy 'count' vertices of 'vertex_size' bytes each into the arena:
+	Range add_vertices(GLsizei vertex_size, size_t count, void const *data);
+
+	//copy element indices into the arena (ranges start at multiples of IndexUnit bytes, so indices of any type line up):
+	enum : size_t { IndexUnit = 4 };
+	Range add_indices(size_t bytes, void const *data);
+
+	//hand a range back (it will be reused by later additions):
+	void remove(Range *range);
+
+	//Vertex array objects, by where each attribute of a vertex layout is bound:
+	struct Binding {
+		GLuint location = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		GLboolean normalized = GL_FALSE;
+		GLsizei offset = 0;
+	};
+	struct Layout {
+		GLsizei stride = 0; //(vertex size; picks the vertex buffer)
+		std::vector< Binding > bindings;
+		bool operator<(Layout const &other) const;
+	};
+	//get the (shared) vertex array object for a layout, which binds the vertex buffer for 'stride' and the element buffer:
+	// (the arena owns it, and keeps it pointed at its buffers as they grow)
+	GLuint vao_for(Layout const &layout);
+
+	//-- internals --
+
+	struct Pool {
+		size_t unit = 0; //bytes per unit
+		GLuint buffer = 0;
+		size_t capacity = 0; //in units
+		std::map< size_t, size_t > free; //free ranges, begin -> count (never adjacent; they're merged)
+	};
+	std::map< GLsizei, Pool > vertex_pools; //by vertex size
+	Pool index_pool;
+
+	std::map< Layout, GLuint > vaos;
+
+	//every pool starts with room for at least this much:
+	enum : size_t { MinBytes = 1 << 20 };
+
+private:
+	GeometryArena();
+
+	Pool &vertex_pool(GLsizei vertex_size);
+	Range allocate(Pool &pool, size_t count, void const *data);
+	void grow(Pool &pool, size_t count);
+	void bind_vao(GLuint vao, Layout const &layout);
+};
@@ -0,0 +1,236 @@
+#include "LightClusters.hpp"
+
+#include "WorkerPool.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+LightClusters::LightClusters(BinOnly_t) {
+	//(no OpenGL objects; only bin() may be called)
+}
+
+LightClusters::LightClusters() {
+	glGenBuffers(1, &lights_buffer);
+	glGenBuffers(1, &ranges_buffer);
+	glGenBuffers(1, &indices_buffer);
+	glGenTextures(1, &lights_tex);
+	glGenTextures(1, &ranges_tex);
+	glGenTextures(1, &indices_tex);
+
+	//attach buffers to buffer textures (buffers will be filled in update()):
+	glBindTexture(GL_TEXTURE_BUFFER, lights_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lights_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, ranges_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, ranges_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, indices_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indices_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+LightClusters::~LightClusters() {
+	if (!lights_tex) return; //(made with BinOnly)
+	glDeleteTextures(1, &lights_tex);
+	glDeleteTextures(1, &ranges_tex);
+	glDeleteTextures(1, &indices_tex);
+	glDeleteBuffers(1, &lights_buffer);
+	glDeleteBuffers(1, &ranges_buffer);
+	glDeleteBuffers(1, &indices_buffer);
+}
+
+float LightClusters::slice_depth(uint32_t slice) const {
+	if (slice >= GridZ) return std::numeric_limits< float >::infinity();
+	return near * std::pow(far / near, float(slice) / float(GridZ));
+}
+
+uint32_t LightClusters::depth_slice(float depth) const {
+	if (!(depth > near)) return 0;
+	float s = std::log(depth / near) / std::log(far / near) * float(GridZ);
+	return uint32_t(std::min(s, float(GridZ - 1)));
+}
+
+void LightClusters::update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size) {
+	assert(lights_tex && "LightClusters made with BinOnly can't upload");
+	bin(scene, camera, drawable_size);
+
+	//upload (buffer textures can't be empty, so always send at least one element):
+	if (light_texels.empty()) light_texels.emplace_back(0.0f);
+	if (indices.empty()) indices.emplace_back(0);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, lights_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, light_texels.size() * sizeof(light_texels[0]), light_texels.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, ranges_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, ranges.size() * sizeof(ranges[0]), ranges.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, indices_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+void LightClusters::bin(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size_) {
+	auto before = std::chrono::high_resolution_clock::now();
+
+	assert(camera.transform);
+	drawable_size = drawable_size_;
+	near = camera.near;
+	glm::mat4x3 world_to_view = camera.transform->make_world_to_local();
+	//projection scale factors (as in Camera::make_projection):
+	float scale_y = 1.0f / std::tan(0.5f * camera.fovy);
+	float scale_x = scale_y / camera.aspect;
+
+	//gather lights -- hemisphere and directional first, then point and spot:
+	light_texels.clear();
+	view_lights.clear();
+	global_count = 0;
+	auto add_texels = [this](Scene::Light const &light, float radius) {
+		glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+		float type = 0.0f;
+		switch (light.type) {
+			case Scene::Light::Point: type = 0.0f; break;
+			case Scene::Light::Hemisphere: type = 1.0f; break;
+			case Scene::Light::Spot: type = 2.0f; break;
+			case Scene::Light::Directional: type = 3.0f; break;
+		}
+		light_texels.emplace_back(light_to_world[3], type);
+		light_texels.emplace_back(glm::normalize(-light_to_world[2]), std::cos(0.5f * light.spot_fov));
+		light_texels.emplace_back(light.energy, radius); //(shaders fade the light out to nothing at 'radius')
+		return uint32_t(light_texels.size() / 3 - 1);
+	};
+	for (auto const &light : scene.lights) {
+		if (light.type == Scene::Light::Hemisphere || light.type == Scene::Light::Directional) {
+			add_texels(light, 0.0f);
+			global_count += 1;
+		}
+	}
+	for (auto const &light : scene.lights) {
+		if (light.type != Scene::Light::Point && light.type != Scene::Light::Spot) continue;
+		assert(light.transform); //lights *must* have a transform
+
+		ViewLight vl;
+		vl.center = world_to_view * glm::vec4(light.transform->make_local_to_world()[3], 1.0f);
+		if (light.distance > 0.0f) {
+			vl.radius = light.distance;
+		} else {
+			//shaders use energy / max(1, distance^2) falloff:
+			float strength = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+			vl.radius = std::sqrt(std::max(1.0f, strength / min_energy));
+		}
+		float depth = -vl.center.z;
+		if (depth + vl.radius < near) continue; //entirely behind the camera
+
+		vl.index = add_texels(light, vl.radius);
+		vl.slice_begin = depth_slice(depth - vl.radius);
+		vl.slice_end = depth_slice(depth + vl.radius) + 1;
+		view_lights.emplace_back(vl);
+	}
+	light_count = uint32_t(light_texels.size() / 3);
+	binned_count = uint32_t(view_lights.size());
+
+	//bin lights into each depth slice's tiles (slices are independent, so they run in parallel):
+	slice_ranges.resize(GridZ);
+	slice_indices.resize(GridZ);
+	WorkerPool::shared().parallel_for(GridZ, 1, [&,this](size_t begin, size_t end) {
+		std::vector< glm::uvec4 > rects; //(light index, tile rect) pairs for this slice, re-used between slices
+		std::vector< uint32_t > lights;
+		for (uint32_t z = uint32_t(begin); z < uint32_t(end); ++z) {
+			float slice_near = slice_depth(z);
+			float slice_far = slice_depth(z + 1);
+
+			rects.clear();
+			lights.clear();
+			for (auto const &vl : view_lights) {
+				if (z < vl.slice_begin || z >= vl.slice_end) continue;
+				float depth = -vl.center.z;
+				float dn = std::max(near, std::max(slice_near, depth - vl.radius));
+				float df = std::min(slice_far, depth + vl.radius);
+
+				//conservative screen-space extent of the sphere's view-space box within [dn,df]:
+				// (ndc = scale * x / depth is most extreme at the nearer depth when x points outward, the further one otherwise)
+				auto ndc_range = [dn, df](float lo, float hi, float scale) {
+					return glm::vec2(
+						scale * lo / (lo < 0.0f ? dn : df),
+						scale * hi / (hi > 0.0f ? dn : df)
+					);
+				};
+				glm::vec2 x = ndc_range(vl.center.x - vl.radius, vl.center.x + vl.radius, scale_x);
+				glm::vec2 y = ndc_range(vl.center.y - vl.radius, vl.center.y + vl.radius, scale_y);
+				if (x.y < -1.0f || x.x > 1.0f || y.y < -1.0f || y.x > 1.0f) continue; //off screen
+
+				auto tile = [](float ndc, uint32_t count) {
+					float t = std::floor((0.5f * ndc + 0.5f) * float(count));
+					return uint32_t(std::max(0.0f, std::min(t, float(count - 1))));
+				};
+				rects.emplace_back(tile(x.x, GridX), tile(y.x, GridY), tile(x.y, GridX), tile(y.y, GridY));
+				lights.emplace_back(vl.index);
+			}
+
+			//count, then fill, the per-tile lists:
+			std::vector< glm::uvec2 > &tile_ranges = slice_ranges[z];
+			tile_ranges.assign(GridX * GridY, glm::uvec2(0));
+			for (auto const &r : rects) {
+				for (uint32_t ty = r.y; ty <= r.w; ++ty) {
+					for (uint32_t tx = r.x; tx <= r.z; ++tx) {
+						tile_ranges[ty * GridX + tx].y += 1;
+					}
+				}
+			}
+			uint32_t total = 0;
+			for (auto &range : tile_ranges) {
+				range.x = total;
+				total += range.y;
+				range.y = 0;
+			}
+			std::vector< uint32_t > &tile_indices = slice_indices[z];
+			tile_indices.resize(total);
+			for (uint32_t i = 0; i < rects.size(); ++i) {
+				glm::uvec4 const &r = rects[i];
+				for (uint32_t ty = r.y; ty <= r.w; ++ty) {
+					for (uint32_t tx = r.x; tx <= r.z; ++tx) {
+						glm::uvec2 &range = tile_ranges[ty * GridX + tx];
+						tile_indices[range.x + range.y] = lights[i];
+						range.y += 1;
+					}
+				}
+			}
+		}
+	});
+
+	//concatenate slices:
+	ranges.clear();
+	indices.clear();
+	for (uint32_t z = 0; z < GridZ; ++z) {
+		uint32_t offset = uint32_t(indices.size());
+		for (auto const &range : slice_ranges[z]) {
+			ranges.emplace_back(range.x + offset, range.y);
+		}
+		indices.insert(indices.end(), slice_indices[z].begin(), slice_indices[z].end());
+	}
+	index_count = uint32_t(indices.size());
+	assert(ranges.size() == ClusterCount);
+
+	auto after = std::chrono::high_resolution_clock::now();
+	binning_ms = std::chrono::duration< float, std::milli >(after - before).count();
+}
+
+void LightClusters::bind() const {
+	glActiveTexture(GL_TEXTURE0 + LightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, lights_tex);
+	glActiveTexture(GL_TEXTURE0 + RangesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, ranges_tex);
+	glActiveTexture(GL_TEXTURE0 + IndicesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, indices_tex);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::unbind() const {
+	for (GLuint unit : { LightsUnit, RangesUnit, IndicesUnit }) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * LightClusters bins a scene's lights into a view-space "froxel" grid for clustered forward lighting.
+ *
+ * The grid splits the camera's view into GridX x GridY screen tiles and GridZ depth slices
+ *  (spaced exponentially from the camera's near plane to 'far'; the last slice extends to infinity).
+ * Each frame, update() finds which clusters every point and spot light's sphere of influence overlaps
+ *  and uploads the per-cluster light lists as buffer textures; set Scene::light_clusters to have
+ *  Scene::draw bind them so lit shaders only loop over the lights in each fragment's cluster.
+ *
+ * Hemisphere and directional lights reach everything, so they are stored first and not binned.
+ * Light positions are stored in world space, so this pairs with Scene::draw(Camera) (world_to_light is identity).
+ *
+ */
+
+#include "Scene.hpp"
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct LightClusters {
+	LightClusters();
+	//..or without OpenGL objects, for binning only (e.g., to time it without a GL context):
+	enum BinOnly_t { BinOnly };
+	LightClusters(BinOnly_t);
+	~LightClusters();
+
+	LightClusters(LightClusters const &) = delete;
+	LightClusters &operator=(LightClusters const &) = delete;
+
+	enum : uint32_t {
+		GridX = 16,
+		GridY = 9,
+		GridZ = 24,
+		ClusterCount = GridX * GridY * GridZ,
+	};
+
+	//texture units Scene::draw binds the buffer textures to (above Pipeline::TextureCount, so they don't collide):
+	enum : GLuint {
+		LightsUnit = 4, //samplerBuffer, three RGBA32F texels per light (see below)
+		RangesUnit = 5, //usamplerBuffer, RG32UI (first index, index count) per cluster
+		IndicesUnit = 6, //usamplerBuffer, R32UI light indices
+	};
+
+	//depth (distance along the view direction) where the last slice starts:
+	float far = 200.0f;
+
+	//Point and spot lights without a cutoff distance are binned out to where their energy falls below this:
+	float min_energy = 1.0f / 256.0f;
+
+	//bin the scene's lights for this camera and upload the results:
+	// (uses WorkerPool::shared() to bin depth slices in parallel; call from the thread with the GL context)
+	void update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size);
+
+	//..just the binning part of update(), which fills in the results below (no OpenGL calls):
+	void bin(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &drawable_size);
+
+	//bind the buffer textures to their units (used by Scene::draw):
+	void bind() const;
+	void unbind() const;
+
+	//-- results of the most recent update() --
+	glm::uvec2 drawable_size = glm::uvec2(0); //(used to map fragment coordinates to tiles)
+	float near = 0.01f; //camera near plane
+	uint32_t global_count = 0; //lights [0,global_count) are hemisphere/directional lights that affect every cluster
+	uint32_t light_count = 0; //total lights stored
+	uint32_t binned_count = 0; //point and spot lights not entirely behind the camera
+	uint32_t index_count = 0; //total entries in all cluster light lists
+	float binning_ms = 0.0f; //CPU time spent in bin()
+
+	//light data, three texels per light:
+	// [0] = (location, type), [1] = (direction, cutoff), [2] = (energy, radius)
+	// (radius is where binning stops, and where shaders fade point and spot lights out to nothing; 0 for unbinned lights)
+	// types are numbered as in Scene::LightInfo
+	std::vector< glm::vec4 > light_texels;
+	std::vector< glm::uvec2 > ranges; //per cluster (x + GridX * (y + GridY * z)): first index, count
+	std::vector< uint32_t > indices;
+
+	//-- internals --
+	struct ViewLight {
+		glm::vec3 center; //view space
+		float radius;
+		uint32_t index; //in light_texels
+		uint32_t slice_begin, slice_end; //depth slices [begin,end) overlapped
+	};
+	std::vector< ViewLight > view_lights;
+	std::vector< std::vector< glm::uvec2 > > slice_ranges; //per-slice ranges, with indices relative to slice_indices
+	std::vector< std::vector< uint32_t > > slice_indices;
+
+	float slice_depth(uint32_t slice) const; //depth where slice starts
+	uint32_t depth_slice(float depth) const; //slice containing depth
+
+	GLuint lights_buffer = 0, ranges_buffer = 0, indices_buffer = 0;
+	GLuint lights_tex = 0, ranges_tex = 0, indices_tex = 0;
+};
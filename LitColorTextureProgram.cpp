@@ -1,27 +1,30 @@
 #include "LitColorTextureProgram.hpp"
 
+#include "LightClusters.hpp"
+#include "Mesh.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
 
-Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+Load< LitColorTextureProgram > lit_color_texture_program_instanced("lit_color_texture_program_instanced", LoadTagEarly, []() -> LitColorTextureProgram const * {
+	return new LitColorTextureProgram(LitColorTextureProgram::Instanced);
+});
+
+Load< LitColorTextureProgram > lit_color_texture_program("lit_color_texture_program", LoadTagEarly, []() -> LitColorTextureProgram const * {
 	LitColorTextureProgram *ret = new LitColorTextureProgram();
 
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	lit_color_texture_program_pipeline.OBJECT_block = ret->OBJECT_block;
 
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	//instanced variant (n.b. loaded first, since it is listed as a dependency above):
+	// (matrices come from the FRAME block; only DEQUANTIZE is a plain uniform)
+	lit_color_texture_program_pipeline.instanced_program = lit_color_texture_program_instanced->program;
+	lit_color_texture_program_pipeline.INSTANCE_TO_WORLD_mat4x3 = lit_color_texture_program_instanced->INSTANCE_TO_WORLD_mat4x3;
+	lit_color_texture_program_pipeline.INSTANCE_LIGHTS_ivec4 = lit_color_texture_program_instanced->INSTANCE_LIGHTS_ivec4;
+	lit_color_texture_program_pipeline.DEQUANTIZE_mat4x3 = lit_color_texture_program_instanced->DEQUANTIZE_mat4x3;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -41,66 +44,172 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	lit_color_texture_program_pipeline.textures[0].target = GL_TEXTURE_2D;
 
 	return ret;
-});
+}, LoadOnGLThread, { &lit_color_texture_program_instanced });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+LitColorTextureProgram::LitColorTextureProgram(Variant variant) {
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
+		(variant == Instanced ?
+		"#version 330\n"
+		"struct Light {\n" //see Scene::LightInfo
+		"	vec3 LOCATION;\n"
+		"	int TYPE;\n"
+		"	vec3 DIRECTION;\n"
+		"	float CUTOFF;\n"
+		"	vec3 ENERGY;\n"
+		"	float RADIUS;\n"
+		"};\n"
+		"layout(std140) uniform FRAME {\n" //see Scene::FrameBlock
+		"	mat4 WORLD_TO_CLIP;\n"
+		"	mat4 WORLD_TO_LIGHT;\n"
+		"	int LIGHT_COUNT;\n"
+		"	Light LIGHTS[32];\n" //Scene::MaxLights
+		"	ivec4 CLUSTER_GRID;\n"
+		"	vec4 CLUSTER_SCALE;\n"
+		"};\n"
+		"uniform mat4x3 DEQUANTIZE;\n" //quantized position -> object space (see Mesh::dequantize)
+		"in mat4x3 INSTANCE_TO_WORLD;\n" //per-instance attributes
+		"in ivec4 INSTANCE_LIGHTS;\n"
+		"in vec4 Position;\n"
+		"in vec3 Normal;\n"
+		"in vec2 NormalOct;\n" //octahedral-encoded normal (quantized meshes; see Mesh.hpp)
+		"in vec4 Color;\n"
+		"in vec2 TexCoord;\n"
+		"out vec3 position;\n"
+		"out vec3 normal;\n"
+		"out vec4 color;\n"
+		"out vec2 texCoord;\n"
+		"flat out ivec4 lights;\n" //indices into LIGHTS, strongest first, -1 if unused
+		"vec3 oct_decode(vec2 e) {\n"
+		"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+		"	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+		"	return normalize(n);\n"
+		"}\n"
+		"void main() {\n"
+		"	vec4 world_position = vec4(INSTANCE_TO_WORLD * vec4(DEQUANTIZE * Position, 1.0), 1.0);\n"
+		"	gl_Position = WORLD_TO_CLIP * world_position;\n"
+		"	position = vec3(WORLD_TO_LIGHT * world_position);\n"
+		"	mat3 normal_to_light = inverse(transpose(mat3(WORLD_TO_LIGHT) * mat3(INSTANCE_TO_WORLD)));\n"
+		"	normal = normal_to_light * (dot(Normal,Normal) > 0.0 ? Normal : oct_decode(NormalOct));\n"
+		"	lights = INSTANCE_LIGHTS;\n"
+		"	color = Color;\n"
+		"	texCoord = TexCoord;\n"
+		"}\n"
+		:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		"layout(std140) uniform OBJECT {\n" //see Scene::ObjectBlock
+		"	mat4 OBJECT_TO_CLIP;\n"
+		"	mat4 OBJECT_TO_LIGHT;\n"
+		"	mat3 NORMAL_TO_LIGHT;\n"
+		"	ivec4 OBJECT_LIGHTS;\n"
+		"};\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
+		"in vec2 NormalOct;\n" //octahedral-encoded normal (quantized meshes; see Mesh.hpp)
 		"in vec4 Color;\n"
 		"in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"flat out ivec4 lights;\n" //indices into LIGHTS, strongest first, -1 if unused
+		"vec3 oct_decode(vec2 e) {\n"
+		"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+		"	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+		"	return normalize(n);\n"
+		"}\n"
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"	position = vec3(OBJECT_TO_LIGHT * Position);\n"
+		"	normal = NORMAL_TO_LIGHT * (dot(Normal,Normal) > 0.0 ? Normal : oct_decode(NormalOct));\n"
+		"	lights = OBJECT_LIGHTS;\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
+		)
 	,
 		//fragment shader:
 		"#version 330\n"
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"struct Light {\n" //see Scene::LightInfo
+		"	vec3 LOCATION;\n"
+		"	int TYPE;\n"
+		"	vec3 DIRECTION;\n"
+		"	float CUTOFF;\n"
+		"	vec3 ENERGY;\n"
+		"	float RADIUS;\n"
+		"};\n"
+		"layout(std140) uniform FRAME {\n" //see Scene::FrameBlock
+		"	mat4 WORLD_TO_CLIP;\n"
+		"	mat4 WORLD_TO_LIGHT;\n"
+		"	int LIGHT_COUNT;\n"
+		"	Light LIGHTS[32];\n" //Scene::MaxLights
+		"	ivec4 CLUSTER_GRID;\n"
+		"	vec4 CLUSTER_SCALE;\n"
+		"};\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
+		"flat in ivec4 lights;\n"
+		"uniform samplerBuffer CLUSTER_LIGHTS;\n" //see LightClusters.hpp
+		"uniform usamplerBuffer CLUSTER_RANGES;\n"
+		"uniform usamplerBuffer CLUSTER_INDICES;\n"
 		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		//point and spot lights fade out smoothly to nothing at RADIUS (if it isn't 0), where LightClusters stops binning them:
+		"float light_window(float dis2, float radius) {\n"
+		"	if (radius <= 0.0) return 1.0;\n"
+		"	float x = dis2 / (radius * radius);\n"
+		"	float w = clamp(1.0 - x * x, 0.0, 1.0);\n"
+		"	return w * w;\n"
+		"}\n"
+		"vec3 light_energy(Light light, vec3 n) {\n"
+		"	if (light.TYPE == 0) { //point light \n"
+		"		vec3 l = (light.LOCATION - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2) * light_window(dis2, light.RADIUS);\n"
+		"		return nl * light.ENERGY;\n"
+		"	} else if (light.TYPE == 1) { //hemi light \n"
+		"		return (dot(n,-light.DIRECTION) * 0.5 + 0.5) * light.ENERGY;\n"
+		"	} else if (light.TYPE == 2) { //spot light \n"
+		"		vec3 l = (light.LOCATION - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2) * light_window(dis2, light.RADIUS);\n"
+		"		float c = dot(l,-light.DIRECTION);\n"
+		"		nl *= smoothstep(light.CUTOFF,mix(light.CUTOFF,1.0,0.1), c);\n"
+		"		return nl * light.ENERGY;\n"
+		"	} else { //(light.TYPE == 3) //directional light \n"
+		"		return max(0.0, dot(n,-light.DIRECTION)) * light.ENERGY;\n"
+		"	}\n"
+		"}\n"
+		"Light cluster_light(int index) {\n"
+		"	vec4 a = texelFetch(CLUSTER_LIGHTS, 3*index+0);\n"
+		"	vec4 b = texelFetch(CLUSTER_LIGHTS, 3*index+1);\n"
+		"	vec4 c = texelFetch(CLUSTER_LIGHTS, 3*index+2);\n"
+		"	return Light(a.xyz, int(a.w), b.xyz, b.w, c.xyz, c.w);\n"
+		"}\n"
+		"void main() {\n"
+		"	vec3 n = normalize(normal);\n"
+		"	vec3 e = vec3(0.0);\n"
+		"	if (CLUSTER_GRID.x == 0) {\n"
+		"		for (int i = 0; i < 4; ++i) {\n" //Scene::MaxObjectLights
+		"			if (lights[i] < 0) break;\n"
+		"			e += light_energy(LIGHTS[lights[i]], n);\n"
+		"		}\n"
+		"	} else {\n"
+		"		for (int i = 0; i < CLUSTER_GRID.w; ++i) {\n"
+		"			e += light_energy(cluster_light(i), n);\n"
+		"		}\n"
+		//find the cluster from window position and depth (depth = near / (1 - gl_FragCoord.z) with an infinite projection):
+		"		ivec2 tile = clamp(ivec2(gl_FragCoord.xy * CLUSTER_SCALE.xy), ivec2(0), CLUSTER_GRID.xy - 1);\n"
+		"		int slice = clamp(int(-log(max(1.0 - gl_FragCoord.z, 1e-7)) * CLUSTER_SCALE.w), 0, CLUSTER_GRID.z - 1);\n"
+		"		uvec2 range = texelFetch(CLUSTER_RANGES, (slice * CLUSTER_GRID.y + tile.y) * CLUSTER_GRID.x + tile.x).xy;\n"
+		"		for (uint i = 0u; i < range.y; ++i) {\n"
+		"			e += light_energy(cluster_light(int(texelFetch(CLUSTER_INDICES, int(range.x + i)).x)), n);\n"
+		"		}\n"
 		"	}\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
@@ -112,20 +221,22 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	//look up the locations of vertex attributes:
 	Position_vec4 = glGetAttribLocation(program, "Position");
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
+	NormalOct_vec2 = glGetAttribLocation(program, "NormalOct");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	INSTANCE_TO_WORLD_mat4x3 = glGetAttribLocation(program, "INSTANCE_TO_WORLD");
+	INSTANCE_LIGHTS_ivec4 = glGetAttribLocation(program, "INSTANCE_LIGHTS");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
+	//look up uniform locations:
+	DEQUANTIZE_mat4x3 = glGetUniformLocation(program, "DEQUANTIZE");
 
+	//look up uniform blocks and attach them to the binding points Scene::draw uses:
+	FRAME_block = glGetUniformBlockIndex(program, "FRAME");
+	if (FRAME_block != GL_INVALID_INDEX) glUniformBlockBinding(program, FRAME_block, Scene::FrameBlockBinding);
+	else FRAME_block = -1U;
+	OBJECT_block = glGetUniformBlockIndex(program, "OBJECT");
+	if (OBJECT_block != GL_INVALID_INDEX) glUniformBlockBinding(program, OBJECT_block, Scene::ObjectBlockBinding);
+	else OBJECT_block = -1U;
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
@@ -134,10 +245,16 @@ LitColorTextureProgram::LitColorTextureProgram() {
 
 	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
 
+	//buffer textures for clustered lighting are bound by Scene::draw:
+	glUniform1i(glGetUniformLocation(program, "CLUSTER_LIGHTS"), LightClusters::LightsUnit);
+	glUniform1i(glGetUniformLocation(program, "CLUSTER_RANGES"), LightClusters::RangesUnit);
+	glUniform1i(glGetUniformLocation(program, "CLUSTER_INDICES"), LightClusters::IndicesUnit);
+
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
+	MeshBuffer::forget_program(program);
 	glDeleteProgram(program);
 	program = 0;
 }
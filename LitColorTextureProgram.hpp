@@ -5,8 +5,15 @@
 #include "Scene.hpp"
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
+// (the 'Instanced' variant reads the object-to-world matrix from the per-instance INSTANCE_TO_WORLD attribute)
+// (camera and lights come from the FRAME uniform block that Scene::draw fills from Scene::lights;
+//  each object is lit by the few lights Scene::draw selected for it)
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	enum Variant {
+		Default,
+		Instanced
+	};
+	LitColorTextureProgram(Variant variant = Default);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -14,27 +21,27 @@ struct LitColorTextureProgram {
 	//Attribute (per-vertex variable) locations:
 	GLuint Position_vec4 = -1U;
 	GLuint Normal_vec3 = -1U;
+	GLuint NormalOct_vec2 = -1U; //(used instead of Normal by quantized meshes)
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
+	GLuint INSTANCE_TO_WORLD_mat4x3 = -1U; //(Instanced variant only)
+	GLuint INSTANCE_LIGHTS_ivec4 = -1U; //(Instanced variant only)
 
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
+	GLuint DEQUANTIZE_mat4x3 = -1U; //(Instanced variant only)
+
+	//Uniform block indices:
+	GLuint FRAME_block = -1U; //camera and light, bound to Scene::FrameBlockBinding
+	GLuint OBJECT_block = -1U; //per-object matrices, bound to Scene::ObjectBlockBinding (Default variant only)
 	
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_program_instanced;
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: also set pipeline.instanced_vao (from lit_color_texture_program_instanced) to allow instanced drawing.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
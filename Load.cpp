@@ -1,32 +1,310 @@
 #include "Load.hpp"
+#include "WorkerPool.hpp"
 
-#include <array>
-#include <list>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
 #include <cassert>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 namespace {
-	std::array< std::list< std::function< void() > >, MaxLoadTag > &get_load_lists() {
-		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
-		return load_lists;
+	//totals for the loading report:
+	struct LoadStats {
+		float ms = 0.0f;
+		uint64_t read = 0;
+		uint64_t uploaded = 0;
+		uint64_t peak_growth = 0; //growth of the process's peak resident memory while running (approximate; see Load.hpp)
+	};
+
+	struct LoadFunction {
+		LoadTag tag;
+		std::function< void() > fn;
+		LoadContext context;
+		std::vector< LoadBase const * > dependencies;
+		std::string name;
+		LoadStats stats;
+	};
+	std::vector< LoadFunction > &get_load_functions() {
+		static std::vector< LoadFunction > load_functions;
+		return load_functions;
+	}
+
+	thread_local LoadStats *running_stats = nullptr; //loader running on this thread, if any
+
+	std::atomic< bool > load_cancelled(false); //set by cancel_load_functions()
+
+	//peak resident memory of the whole process so far, in bytes (0 if unavailable):
+	// (an OS counter, so sampling it doesn't slow down allocation the way hooking operator new would)
+	uint64_t peak_resident_bytes() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return uint64_t(counters.PeakWorkingSetSize);
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+		return uint64_t(usage.ru_maxrss); //(bytes on macOS)
+#else
+		return uint64_t(usage.ru_maxrss) * 1024; //(kilobytes on Linux)
+#endif
+#endif
+	}
+
+	//run a loading function, recording its stats:
+	void run_load_function(LoadFunction &lf) {
+		running_stats = &lf.stats;
+		uint64_t peak_before = peak_resident_bytes();
+		auto before = std::chrono::high_resolution_clock::now();
+		try {
+			lf.fn();
+		} catch (...) {
+			running_stats = nullptr;
+			throw;
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		running_stats = nullptr;
+		lf.stats.ms = std::chrono::duration< float, std::milli >(after - before).count();
+		uint64_t peak_after = peak_resident_bytes();
+		lf.stats.peak_growth = (peak_after > peak_before ? peak_after - peak_before : 0);
+	}
+
+	void write_load_report(std::vector< LoadFunction > const &load_functions, float total_ms) {
+		char const *setting = std::getenv("LOAD_REPORT");
+		if (!setting || !*setting || std::string(setting) == "0") return;
+
+		std::vector< LoadFunction const * > sorted;
+		for (auto const &lf : load_functions) sorted.emplace_back(&lf);
+		std::stable_sort(sorted.begin(), sorted.end(), [](LoadFunction const *a, LoadFunction const *b) {
+			return a->stats.ms > b->stats.ms;
+		});
+		auto display_name = [&](LoadFunction const &lf) {
+			if (!lf.name.empty() && lf.name[0] != ' ') return lf.name;
+			return "(unnamed #" + std::to_string(&lf - &load_functions[0]) + ")" + lf.name;
+		};
+		char const *tag_names[MaxLoadTag] = { "early", "default", "late" };
+
+		std::string path = setting;
+		if (path.size() >= 5 && path.substr(path.size() - 5) == ".json") {
+			auto quoted = [](std::string const &str) {
+				std::string ret = "\"";
+				for (char c : str) {
+					if (c == '"' || c == '\\') ret += '\\';
+					ret += c;
+				}
+				return ret + "\"";
+			};
+			std::ofstream out(path, std::ios::binary);
+			out << "{\n\t\"total_ms\": " << total_ms << ",\n\t\"loaders\": [\n";
+			for (auto const *lf : sorted) {
+				out << "\t\t{ \"name\": " << quoted(display_name(*lf))
+					<< ", \"tag\": \"" << tag_names[lf->tag] << "\""
+					<< ", \"thread\": \"" << (lf->context == LoadOnGLThread ? "gl" : "worker") << "\""
+					<< ", \"ms\": " << lf->stats.ms
+					<< ", \"bytes_read\": " << lf->stats.read
+					<< ", \"bytes_uploaded\": " << lf->stats.uploaded
+					<< ", \"peak_memory_growth\": " << lf->stats.peak_growth
+					<< " }" << (lf == sorted.back() ? "" : ",") << "\n";
+			}
+			out << "\t]\n}\n";
+			if (!out) {
+				std::cerr << "WARNING: failed to write loading report to '" << path << "'." << std::endl;
+			} else {
+				std::cout << "Wrote loading report to '" << path << "'." << std::endl;
+			}
+			return;
+		}
+
+		std::ostringstream out;
+		out << "Loading took " << std::fixed << std::setprecision(1) << total_ms << " ms:\n";
+		out << "      ms        read    uploaded   peak mem+  thread  tag      name\n";
+		for (auto const *lf : sorted) {
+			out << std::setw(8) << lf->stats.ms
+				<< std::setw(12) << lf->stats.read
+				<< std::setw(12) << lf->stats.uploaded
+				<< std::setw(12) << lf->stats.peak_growth
+				<< "  " << std::left << std::setw(6) << (lf->context == LoadOnGLThread ? "gl" : "worker")
+				<< "  " << std::setw(7) << tag_names[lf->tag] << std::right
+				<< "  " << display_name(*lf) << "\n";
+		}
+		out << "(peak mem+ is how much each loader raised the process's peak resident memory; it is sampled process-wide,\n"
+		       " so it is approximate when loaders run in parallel)\n";
+		std::cout << out.str();
+		std::cout.flush();
 	}
 }
 
-void add_load_function(LoadTag tag, std::function< void() > const &fn) {
-	auto &load_lists = get_load_lists();
-	assert(tag < load_lists.size());
-	load_lists[tag].emplace_back(fn);
+uint32_t add_load_function(LoadTag tag, std::function< void() > const &fn, LoadContext context, std::vector< LoadBase const * > const &dependencies, std::string const &name) {
+	auto &load_functions = get_load_functions();
+	assert(tag < MaxLoadTag);
+	load_functions.emplace_back(LoadFunction{tag, fn, context, dependencies, name, LoadStats()});
+	return uint32_t(load_functions.size() - 1);
+}
+
+void cancel_load_functions() {
+	load_cancelled = true;
+}
+
+void note_load_read(size_t bytes) {
+	if (running_stats) running_stats->read += bytes;
+}
+
+void note_load_uploaded(size_t bytes) {
+	if (running_stats) running_stats->uploaded += bytes;
 }
 
-void call_load_functions() {
+bool call_load_functions(std::function< void() > const &while_waiting) {
 	static bool has_been_called = false;
 	assert(!has_been_called && "call_load_functions should only be called *once*");
 	has_been_called = true;
 
-	auto &load_lists = get_load_lists();
-	for (auto &fn_list : load_lists) {
-		while (!fn_list.empty()) {
-			(*fn_list.begin())(); //call first function in the list
-			fn_list.pop_front(); //remove from list
+	auto &load_functions = get_load_functions();
+	auto load_before = std::chrono::high_resolution_clock::now();
+
+	//resolve dependencies to indices:
+	std::vector< std::vector< uint32_t > > dependencies(load_functions.size());
+	for (uint32_t i = 0; i < load_functions.size(); ++i) {
+		for (LoadBase const *dep : load_functions[i].dependencies) {
+			if (!dep || dep->load_index >= load_functions.size()) {
+				throw std::runtime_error("Loading function depends on something that isn't a loader.");
+			}
+			if (load_functions[dep->load_index].tag > load_functions[i].tag) {
+				throw std::runtime_error("Loading function depends on a loader with a later tag.");
+			}
+			dependencies[i].emplace_back(dep->load_index);
+		}
+	}
+
+	std::vector< bool > done(load_functions.size(), false);
+	std::vector< bool > started(load_functions.size(), false);
+
+	//worker jobs report back through here:
+	std::mutex finished_mutex;
+	std::condition_variable finished_cv;
+	std::deque< std::pair< uint32_t, std::exception_ptr > > finished;
+	uint32_t running = 0; //worker jobs started but not yet reported (only touched by this thread)
+
+	std::exception_ptr failure;
+
+	//record finished worker jobs; if 'block', wait for at least one first:
+	auto collect = [&](bool block) {
+		std::unique_lock< std::mutex > lock(finished_mutex);
+		auto any_finished = [&](){ return !finished.empty(); };
+		while (block && !any_finished()) {
+			if (!while_waiting) {
+				finished_cv.wait(lock, any_finished);
+			} else if (!finished_cv.wait_for(lock, std::chrono::milliseconds(10), any_finished)) {
+				lock.unlock();
+				while_waiting();
+				lock.lock();
+			}
+		}
+		while (!finished.empty()) {
+			done[finished.front().first] = true;
+			if (finished.front().second && !failure) failure = finished.front().second;
+			finished.pop_front();
+			running -= 1;
+		}
+	};
+
+	for (uint32_t tag = 0; tag < MaxLoadTag; ++tag) {
+		std::vector< uint32_t > todo;
+		for (uint32_t i = 0; i < load_functions.size(); ++i) {
+			if (load_functions[i].tag == tag) todo.emplace_back(i);
+		}
+
+		auto ready = [&](uint32_t i) {
+			for (uint32_t d : dependencies[i]) {
+				if (!done[d]) return false;
+			}
+			return true;
+		};
+
+		uint32_t next_gl = 0; //GL-thread functions run in the order they were added; this is the next one
+		while (!failure && !load_cancelled) {
+			//start every worker function whose dependencies are done:
+			for (uint32_t i : todo) {
+				if (started[i] || load_functions[i].context != LoadOnAnyThread || !ready(i)) continue;
+				started[i] = true;
+				running += 1;
+				LoadFunction *lf = &load_functions[i];
+				WorkerPool::shared().run([i,lf,&finished_mutex,&finished_cv,&finished](){
+					std::exception_ptr error;
+					try {
+						run_load_function(*lf);
+					} catch (...) {
+						error = std::current_exception();
+					}
+					std::unique_lock< std::mutex > lock(finished_mutex);
+					finished.emplace_back(i, error);
+					finished_cv.notify_all();
+				});
+			}
+
+			//run the next GL-thread function if it can go:
+			while (next_gl < todo.size() && load_functions[todo[next_gl]].context != LoadOnGLThread) ++next_gl;
+			if (next_gl < todo.size() && ready(todo[next_gl])) {
+				uint32_t i = todo[next_gl];
+				started[i] = true;
+				try {
+					run_load_function(load_functions[i]);
+				} catch (...) {
+					failure = std::current_exception();
+				}
+				done[i] = true;
+				++next_gl;
+				collect(false);
+				continue;
+			}
+
+			bool all_done = true;
+			for (uint32_t i : todo) {
+				if (!done[i]) all_done = false;
+			}
+			if (all_done) break;
+
+			//nothing can start until a worker finishes:
+			if (running == 0) {
+				failure = std::make_exception_ptr(std::runtime_error("Loading functions have circular dependencies."));
+				break;
+			}
+			collect(true);
 		}
+		if (failure || load_cancelled) break;
 	}
+
+	//worker jobs reference this stack frame, so let them stop before leaving:
+	while (running) collect(true);
+
+	if (failure) {
+		load_functions.clear();
+		std::rethrow_exception(failure);
+	}
+	if (load_cancelled) {
+		load_functions.clear();
+		return false;
+	}
+
+	auto load_after = std::chrono::high_resolution_clock::now();
+	write_load_report(load_functions, std::chrono::duration< float, std::milli >(load_after - load_before).count());
+
+	load_functions.clear();
+	return true;
 }
@@ -20,10 +20,42 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * Within a tag, loading functions may also declare dependencies on other loaders and say which thread they may run on:
+ *
+ * Load< Scene > level_scene(LoadTagDefault, []() -> Scene const * {
+ *     return new Scene(data_path("level.scene"), ...uses level_meshes->lookup...);
+ * }, LoadOnAnyThread, { &level_meshes });
+ *
+ * LoadOnAnyThread functions run on WorkerPool::shared() as soon as their dependencies are done, so independent
+ *  files are read and parsed in parallel; they must not use OpenGL. LoadOnGLThread functions (the default) run on
+ *  the thread that calls call_load_functions(), in the order they were added.
+ *
+ * Resources that need OpenGL can still do most of their work on a worker by loading in two phases:
+ *
+ * Load< MeshBuffer > level_meshes(LoadTagDefault, []() -> MeshBuffer * {
+ *     return new MeshBuffer(data_path("level.pnct"), MeshBuffer::DeferUpload); //'prepare': read + parse (any thread)
+ * }, [](MeshBuffer &meshes) {
+ *     meshes.upload(); //'finalize': OpenGL calls (GL thread)
+ * });
+ *
+ * Loaders may also be given a name (e.g., Load< Scene > level_scene("level_scene", LoadTagDefault, ...)), which is used
+ *  in the startup report call_load_functions() prints when the LOAD_REPORT environment variable is set:
+ *   LOAD_REPORT=1 prints a table of loaders (slowest first) to stdout;
+ *   LOAD_REPORT=some/file.json writes the same information as JSON.
+ * The report lists each loader's time, the file bytes and GL upload bytes it reported through note_load_read()
+ *  and note_load_uploaded(), and how much it raised the process's peak resident memory.
+ *  (That last column is sampled process-wide before and after each loader, so it is approximate when loaders run
+ *   in parallel, and is zero for a loader that stays under a peak reached earlier.)
+ *
  */
 
 #include <functional>
 #include <stdexcept>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
 
 enum LoadTag : uint32_t {
 	LoadTagEarly,
@@ -32,14 +64,43 @@ enum LoadTag : uint32_t {
 	MaxLoadTag //<-- just used to track # of load tags
 };
 
+//Where a loading function is allowed to run:
+enum LoadContext : uint32_t {
+	LoadOnGLThread, //on the thread calling call_load_functions() (which has the OpenGL context)
+	LoadOnAnyThread, //on a worker thread, concurrently with other loaders (must not use OpenGL)
+};
+
+//Anything that can be named as a dependency of a loading function:
+// (dependencies are stored as pointers and only resolved in call_load_functions(), so they may be in other files)
+struct LoadBase {
+	uint32_t load_index = -1U; //set by add_load_function
+};
+
 //Add a function to an internal list of loading functions:
+// 'dependencies' must have the same or an earlier tag and finish before fn starts
+// 'name' (if given) is used in the loading report
 // (only call *before* "call_load_functions()")
-void add_load_function(LoadTag tag, std::function< void() > const &fn);
+uint32_t add_load_function(LoadTag tag, std::function< void() > const &fn,
+	LoadContext context = LoadOnGLThread, std::vector< LoadBase const * > const &dependencies = {},
+	std::string const &name = "");
 
 //Call all loading functions:
-// (loading functions may throw exceptions if they fail.)
+// tags run one after another; within a tag, loaders run as soon as their dependencies are done
+// 'while_waiting' (if given) is called every few milliseconds while the GL thread waits on workers (e.g., to pump window events)
+// (loading functions may throw exceptions if they fail; the first exception is re-thrown once running loaders stop.)
+// returns false if loading was cancelled (see cancel_load_functions), in which case loaded values may be missing
 // (only call *once*)
-void call_load_functions();
+bool call_load_functions(std::function< void() > const &while_waiting = nullptr);
+
+//Stop loading early (e.g., from 'while_waiting' when the user closes the window):
+// no more loading functions start; call_load_functions() waits for the ones already running, then returns false
+// (safe to call from any thread)
+void cancel_load_functions();
+
+//Called by loading code to add to the running loader's totals in the loading report:
+// (counts go to whichever loading function is running on the calling thread; they are ignored outside of loading)
+void note_load_read(size_t bytes); //bytes read from files
+void note_load_uploaded(size_t bytes); //bytes sent to OpenGL
 
 
 //work-around for MSVC not accepting this as a lambda:
@@ -47,15 +108,43 @@ template< typename T >
 T const *new_T() { return new T; }
 
 template< typename T >
-struct Load {
+struct Load : LoadBase {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
-	Load(LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >) : value(nullptr) {
-		add_load_function(tag, [this,load_fn](){
+	Load(LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >,
+		LoadContext context = LoadOnGLThread, std::initializer_list< LoadBase const * > dependencies = {})
+		: Load(nullptr, tag, load_fn, context, dependencies) { }
+
+	//...with a name for the loading report:
+	Load(char const *name, LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >,
+		LoadContext context = LoadOnGLThread, std::initializer_list< LoadBase const * > dependencies = {}) : value(nullptr) {
+		load_index = add_load_function(tag, [this,load_fn](){
 			this->value = load_fn();
 			if (!(this->value)) {
 				throw std::runtime_error("Loading failed.");
 			}
-		});
+		}, context, dependencies, name ? name : "");
+	}
+
+	//Two-phase loading: 'prepare_fn' builds the object on a worker thread (it must not use OpenGL),
+	// then 'finalize_fn' runs on the GL thread to do any uploads; the Load<> only has a value after both:
+	Load(LoadTag tag, const std::function< T *() > &prepare_fn, const std::function< void(T &) > &finalize_fn,
+		std::initializer_list< LoadBase const * > dependencies = {})
+		: Load(nullptr, tag, prepare_fn, finalize_fn, dependencies) { }
+
+	Load(char const *name, LoadTag tag, const std::function< T *() > &prepare_fn, const std::function< void(T &) > &finalize_fn,
+		std::initializer_list< LoadBase const * > dependencies = {}) : value(nullptr) {
+		std::string base = (name ? name : "");
+		prepared.load_index = add_load_function(tag, [this,prepare_fn](){
+			this->pending = prepare_fn();
+			if (!(this->pending)) {
+				throw std::runtime_error("Loading failed.");
+			}
+		}, LoadOnAnyThread, dependencies, base + " (prepare)");
+		load_index = add_load_function(tag, [this,finalize_fn](){
+			finalize_fn(*this->pending);
+			this->value = this->pending;
+			this->pending = nullptr;
+		}, LoadOnGLThread, { &prepared }, base + " (finalize)");
 	}
 
 	//Make a "Load< T >" behave like a "T const *":
@@ -65,16 +154,25 @@ struct Load {
 	T const *operator->() { return value; }
 
 	T const *value;
+
+	//-- internals (two-phase loading) --
+	T *pending = nullptr; //set by prepare_fn, handed to finalize_fn
+	LoadBase prepared; //the prepare step, as a dependency of the finalize step
 };
 
 
 //Specialization:
 //Load< void > just calls a function:
 template< >
-struct Load< void > {
+struct Load< void > : LoadBase {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
-	Load( LoadTag tag, const std::function< void() > &load_fn) {
-		add_load_function(tag, load_fn);
+	Load( LoadTag tag, const std::function< void() > &load_fn,
+		LoadContext context = LoadOnGLThread, std::initializer_list< LoadBase const * > dependencies = {})
+		: Load(nullptr, tag, load_fn, context, dependencies) { }
+
+	Load( char const *name, LoadTag tag, const std::function< void() > &load_fn,
+		LoadContext context = LoadOnGLThread, std::initializer_list< LoadBase const * > dependencies = {}) {
+		load_index = add_load_function(tag, load_fn, context, dependencies, name ? name : "");
 	}
 };
 
@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * A MappedFile maps a whole file read-only into memory.
+ *
+ * Pages are read from disk (or the OS page cache) when first touched,
+ *  so reading chunks through a ChunkReader (read_write_chunk.hpp) over a
+ *  MappedFile doesn't copy file contents onto the heap.
+ *
+ */
+
+#include <string>
+#include <cstddef>
+
+struct MappedFile {
+	//map a file:
+	// note: will throw if file fails to open or map.
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data() const { return bytes; }
+	size_t size() const { return length; }
+
+	//-- internals --
+	char const *bytes = nullptr; //(nullptr for empty files, which can't be mapped)
+	size_t length = 0;
+#ifdef _WIN32
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+#else
+	int fd = -1;
+#endif
+};
@@ -1,23 +1,20 @@
 #include "Mesh.hpp"
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
+#include "Load.hpp"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
-#include <set>
+#include <unordered_map>
 #include <cstddef>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
-
-	std::ifstream file(filename, std::ios::binary);
-
-	GLuint total = 0;
-
+namespace {
 	struct Vertex {
 		glm::vec3 Position;
 		glm::vec3 Normal;
@@ -25,16 +22,104 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
 
-	//read + upload data chunk:
-	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+	//compact layout (see MeshBuffer::Attrib):
+	struct QuantizedVertex {
+		glm::u16vec3 Position; //fraction of the mesh's bounding box (see Mesh::dequantize)
+		uint16_t padding;
+		glm::i16vec2 NormalOct; //octahedral-encoded unit normal
+		glm::u8vec4 Color;
+		glm::u16vec2 TexCoord; //half floats
+	};
+	static_assert(sizeof(QuantizedVertex) == 3*2+2+2*2+4*1+2*2, "QuantizedVertex is packed.");
+}
+
+struct MeshBuffer::Pending {
+	Pending(std::string const &filename) : file(filename) { }
+	MappedFile file;
+	ChunkView< Vertex > data; //usually points straight into 'file'
+	ChunkView< QuantizedVertex > quantized; //(used instead of 'data' by quantized files)
+	ChunkView< uint16_t > indices16; //(indexed files have one of these)
+	ChunkView< uint32_t > indices32;
+};
+
+MeshBuffer::MeshBuffer(std::string const &filename) : MeshBuffer(filename, DeferUpload) {
+	upload();
+}
+
+MeshBuffer::~MeshBuffer() {
+	//(only upload() allocates ranges, so a MeshBuffer that was never uploaded -- e.g., one dropped by a failed load on a worker -- doesn't touch the arena)
+	if (vertices.pool) GeometryArena::get().remove(&vertices);
+	if (indices.pool) GeometryArena::get().remove(&indices);
+}
+
+void MeshBuffer::upload() {
+	if (!pending) return;
+	GeometryArena &arena = GeometryArena::get();
+
+	//copy data into the arena (straight from the mapping):
+	size_t bytes = pending->data.size() * sizeof(Vertex) + pending->quantized.size() * sizeof(QuantizedVertex);
+	if (pending->quantized.empty()) {
+		vertices = arena.add_vertices(sizeof(Vertex), pending->data.size(), pending->data.data());
+	} else {
+		vertices = arena.add_vertices(sizeof(QuantizedVertex), pending->quantized.size(), pending->quantized.data());
+	}
+	note_load_uploaded(bytes);
+
+	size_t index_size = (pending->indices16.empty() ? sizeof(uint32_t) : sizeof(uint16_t));
+	if (!pending->indices16.empty() || !pending->indices32.empty()) {
+		size_t bytes = pending->indices16.size() * sizeof(uint16_t) + pending->indices32.size() * sizeof(uint32_t);
+		void const *data = (pending->indices16.empty() ? static_cast< void const * >(pending->indices32.data()) : pending->indices16.data());
+		indices = arena.add_indices(bytes, data);
+		note_load_uploaded(bytes);
+	}
+
+	//meshes now start where this buffer's ranges do:
+	GLuint vertex_base = GLuint(vertices.begin);
+	GLuint index_base = GLuint(indices.begin * GeometryArena::IndexUnit / index_size);
+	for (auto &m : meshes) {
+		Mesh &mesh = m.second;
+		mesh.start += vertex_base;
+		mesh.index_start += index_base;
+		for (auto &lod : mesh.lods) {
+			lod.start += vertex_base;
+			lod.index_start += index_base;
+		}
+	}
+	for (auto &meshlet : meshlets) {
+		meshlet.index_begin += index_base;
+		meshlet.index_end += index_base;
+	}
+
+	pending.reset(); //done with the file
+}
+
+MeshBuffer::MeshBuffer(std::string const &filename, DeferUpload_t) {
+	//chunks are read in place from the mapped file (no intermediate copies):
+	pending.reset(new Pending(filename));
+	MappedFile const &file = pending->file;
+	ChunkReader reader(file.data(), file.data() + file.size());
+	note_load_read(file.size());
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLuint total = 0;
+
+	ChunkView< Vertex > &data = pending->data;
+
+	//read data chunk:
+	bool quantized = false;
+	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct" && reader.next_chunk_is("pnq0")) {
+		pending->quantized = reader.read_chunk< QuantizedVertex >("pnq0");
+		quantized = true;
+
+		total = GLuint(pending->quantized.size());
+
+		//store attrib locations:
+		Position = Attrib(3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Position));
+		NormalOct = Attrib(2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, NormalOct));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Color));
+		TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, TexCoord));
+	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
+		data = reader.read_chunk< Vertex >("pnct");
 
 		total = GLuint(data.size()); //store total for later checks on index
 
@@ -47,18 +132,108 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
-	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
+	//read (optional) element indices -- each mesh's indices are relative to its first vertex:
+	GLenum index_type = GL_NONE;
+	size_t index_total = 0;
+	if (reader.next_chunk_is("ix16")) {
+		pending->indices16 = reader.read_chunk< uint16_t >("ix16");
+		index_type = GL_UNSIGNED_SHORT;
+		index_total = pending->indices16.size();
+	} else if (reader.next_chunk_is("ix32")) {
+		pending->indices32 = reader.read_chunk< uint32_t >("ix32");
+		index_type = GL_UNSIGNED_INT;
+		index_total = pending->indices32.size();
+	}
+	auto index_at = [&](size_t i) -> uint32_t {
+		return (index_type == GL_UNSIGNED_SHORT ? pending->indices16[i] : pending->indices32[i]);
+	};
+
+	ChunkView< char > strings = reader.read_chunk< char >("str0");
 
 	{ //read index chunk, add to meshes:
+		// (idx0 for non-indexed files; idx1 adds each mesh's range of element indices)
 		struct IndexEntry {
 			uint32_t name_begin, name_end;
 			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end;
+		};
+		static_assert(sizeof(IndexEntry) == 24, "Index entry should be packed");
+		struct IndexEntry0 {
+			uint32_t name_begin, name_end;
+			uint32_t vertex_begin, vertex_end;
 		};
-		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+		static_assert(sizeof(IndexEntry0) == 16, "Index entry should be packed");
 
 		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		if (index_type == GL_NONE) {
+			ChunkView< IndexEntry0 > index0 = reader.read_chunk< IndexEntry0 >("idx0");
+			for (auto const &entry : index0) {
+				index.emplace_back(IndexEntry{entry.name_begin, entry.name_end, entry.vertex_begin, entry.vertex_end, 0, 0});
+			}
+		} else {
+			ChunkView< IndexEntry > index1 = reader.read_chunk< IndexEntry >("idx1");
+			index.assign(index1.begin(), index1.end());
+		}
+
+		//quantized files also have each mesh's bounding box (in the same order as the index):
+		struct Bounds {
+			glm::vec3 min, max;
+		};
+		static_assert(sizeof(Bounds) == 24, "Bounds should be packed");
+		ChunkView< Bounds > bounds;
+		if (quantized) {
+			bounds = reader.read_chunk< Bounds >("bnd0");
+			if (bounds.size() != index.size()) {
+				throw std::runtime_error("bounds chunk doesn't match index chunk");
+			}
+		}
+
+		//(optional) switch sizes for level-of-detail meshes (in the same order as the index; 0 for other meshes):
+		ChunkView< float > lod_sizes;
+		if (reader.next_chunk_is("lod0")) {
+			lod_sizes = reader.read_chunk< float >("lod0");
+			if (lod_sizes.size() != index.size()) {
+				throw std::runtime_error("lod chunk doesn't match index chunk");
+			}
+		}
+
+		//(optional) meshlets, sorted by element index:
+		if (reader.next_chunk_is("mlt0")) {
+			if (index_type == GL_NONE) {
+				throw std::runtime_error("meshlets in a file without element indices");
+			}
+			ChunkView< Meshlet > mlt0 = reader.read_chunk< Meshlet >("mlt0");
+			meshlets.assign(mlt0.begin(), mlt0.end());
+			for (uint32_t i = 0; i < meshlets.size(); ++i) {
+				Meshlet const &meshlet = meshlets[i];
+				if (!(meshlet.index_begin <= meshlet.index_end && meshlet.index_end <= index_total)) {
+					throw std::runtime_error("meshlet has out-of-range element index start/count");
+				}
+				if (i > 0 && meshlets[i-1].index_end > meshlet.index_begin) {
+					throw std::runtime_error("meshlets are not sorted by element index");
+				}
+			}
+		}
+		//the meshlets within an element index range:
+		auto meshlets_in = [&](uint32_t begin, uint32_t end, Mesh *mesh) {
+			auto first = std::lower_bound(meshlets.begin(), meshlets.end(), begin, [](Meshlet const &m, uint32_t i) {
+				return m.index_begin < i;
+			});
+			auto last = first;
+			while (last != meshlets.end() && last->index_end <= end) ++last;
+			if (last == first) return;
+			mesh->meshlets = &*first;
+			mesh->meshlet_count = uint32_t(last - first);
+		};
+
+		//"<name>.lodN" meshes, to attach to "<name>" once every mesh is read:
+		struct Level {
+			std::string base;
+			uint32_t level;
+			Mesh::LOD lod;
+			Mesh const *mesh;
+		};
+		std::vector< Level > levels;
 
 		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
@@ -67,26 +242,88 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= index_total)) {
+				throw std::runtime_error("index entry has out-of-range element index start/count");
+			}
 			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
-			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+			if (index_type == GL_NONE) {
+				mesh.count = entry.vertex_end - entry.vertex_begin;
+			} else {
+				mesh.index_type = index_type;
+				mesh.index_start = entry.index_begin;
+				mesh.count = entry.index_end - entry.index_begin;
+				for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+					if (index_at(i) >= entry.vertex_end - entry.vertex_begin) {
+						throw std::runtime_error("mesh '" + name + "' has an element index outside of its vertices");
+					}
+				}
+				meshlets_in(entry.index_begin, entry.index_end, &mesh);
 			}
-			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
-			if (!inserted) {
+			if (quantized) {
+				//positions are stored relative to the bounds from the bnd0 chunk:
+				Bounds const &b = bounds[&entry - &index[0]];
+				mesh.min = b.min;
+				mesh.max = b.max;
+				mesh.dequantize = glm::mat4x3(
+					glm::vec3(b.max.x - b.min.x, 0.0f, 0.0f),
+					glm::vec3(0.0f, b.max.y - b.min.y, 0.0f),
+					glm::vec3(0.0f, 0.0f, b.max.z - b.min.z),
+					b.min
+				);
+			} else {
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					mesh.min = glm::min(mesh.min, data[v].Position);
+					mesh.max = glm::max(mesh.max, data[v].Position);
+				}
+			}
+			auto ret = meshes.insert(std::make_pair(name, mesh));
+			if (!ret.second) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
+				continue;
+			}
+
+			size_t suffix = name.rfind(".lod");
+			if (suffix != std::string::npos && suffix + 4 < name.size()
+			 && name.find_first_not_of("0123456789", suffix + 4) == std::string::npos) {
+				Level level;
+				level.base = name.substr(0, suffix);
+				level.level = uint32_t(std::stoul(name.substr(suffix + 4)));
+				level.lod.start = mesh.start;
+				level.lod.count = mesh.count;
+				level.lod.index_start = mesh.index_start;
+				level.lod.dequantize = mesh.dequantize;
+				if (!lod_sizes.empty()) level.lod.max_size = lod_sizes[&entry - &index[0]];
+				else level.lod.max_size = std::ldexp(1.0f, -int(std::min(level.level, 30U)));
+				level.mesh = &ret.first->second;
+				if (level.level > 0) levels.emplace_back(level);
 			}
 		}
+
+		//attach levels of detail to their meshes:
+		std::stable_sort(levels.begin(), levels.end(), [](Level const &a, Level const &b) {
+			return a.level < b.level;
+		});
+		for (auto const &level : levels) {
+			auto f = meshes.find(level.base);
+			if (f == meshes.end()) continue; //(just a mesh with an unfortunate name)
+			Mesh &mesh = f->second;
+			if (level.mesh->type != mesh.type || level.mesh->index_type != mesh.index_type) {
+				std::cerr << "WARNING: level-of-detail mesh '" << level.base << ".lod" << level.level << "' in filename '" << filename << "' isn't drawn the same way as its mesh; ignoring it." << std::endl;
+				continue;
+			}
+			mesh.lods.emplace_back(level.lod);
+		}
 	}
 
-	if (file.peek() != EOF) {
+	if (!reader.at_end()) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
+	build_name_table();
+
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
 	for (auto const &m : meshes) {
@@ -98,53 +335,167 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	*/
 }
 
+void MeshBuffer::read_triangles(Mesh const &mesh, std::vector< glm::vec3 > *corners) const {
+	assert(corners);
+	if (!pending) throw std::runtime_error("Reading triangles from a MeshBuffer that was already uploaded.");
+	if (mesh.type != GL_TRIANGLES) throw std::runtime_error("Reading triangles from a mesh that isn't a triangle list.");
+
+	auto position = [&](uint32_t v) -> glm::vec3 {
+		if (pending->quantized.empty()) return pending->data[v].Position;
+		glm::vec3 fraction = glm::vec3(pending->quantized[v].Position) / 65535.0f;
+		return mesh.dequantize * glm::vec4(fraction, 1.0f);
+	};
+
+	std::vector< uint32_t > vertices;
+	read_triangle_vertices(mesh, &vertices);
+	for (uint32_t v : vertices) {
+		corners->emplace_back(position(v));
+	}
+}
+
+void MeshBuffer::read_triangle_vertices(Mesh const &mesh, std::vector< uint32_t > *vertices) const {
+	assert(vertices);
+	if (!pending) throw std::runtime_error("Reading triangles from a MeshBuffer that was already uploaded.");
+	if (mesh.type != GL_TRIANGLES) throw std::runtime_error("Reading triangles from a mesh that isn't a triangle list.");
+
+	for (uint32_t i = 0; i + 2 < mesh.count; i += 3) {
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t v = mesh.start + i + c;
+			if (mesh.index_type == GL_UNSIGNED_SHORT) v = mesh.start + pending->indices16[mesh.index_start + i + c];
+			else if (mesh.index_type == GL_UNSIGNED_INT) v = mesh.start + pending->indices32[mesh.index_start + i + c];
+			vertices->emplace_back(v);
+		}
+	}
+}
+
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
-	auto f = meshes.find(name);
-	if (f == meshes.end()) {
-		throw std::runtime_error("Looking up mesh '" + name + "' that doesn't exist.");
+	if (!name_table.empty()) {
+		uint64_t hash = hash_name(name);
+		size_t mask = name_table.size() - 1;
+		for (size_t i = size_t(hash) & mask; name_table[i].entry; i = (i + 1) & mask) {
+			if (name_table[i].hash == hash && name_table[i].entry->first == name) return name_table[i].entry->second;
+		}
+	}
+	throw std::runtime_error("Looking up mesh '" + name + "' that doesn't exist.");
+}
+
+void MeshBuffer::build_name_table() {
+	//at most half full, so probe sequences stay short:
+	size_t size = 1;
+	while (size < 2 * meshes.size()) size *= 2;
+	name_table.assign(size, NameSlot());
+
+	size_t mask = size - 1;
+	for (auto const &m : meshes) {
+		uint64_t hash = hash_name(m.first);
+		size_t i = size_t(hash) & mask;
+		while (name_table[i].entry) i = (i + 1) & mask;
+		name_table[i].hash = hash;
+		name_table[i].entry = &m;
 	}
-	return f->second;
+}
+
+uint64_t MeshBuffer::hash_name(std::string const &name) {
+	//FNV-1a, then a final mix so the low bits (used to pick a slot) depend on every character:
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (char c : name) {
+		hash = (hash ^ uint8_t(c)) * 0x100000001b3ULL;
+	}
+	hash ^= hash >> 32;
+	return hash;
+}
+
+//The attributes a program reads, found once per program:
+// (GL reuses program names after glDeleteProgram, so programs that make vaos call MeshBuffer::forget_program when deleted)
+namespace {
+	struct ProgramAttributes {
+		struct Attribute {
+			std::string name;
+			GLint location;
+		};
+		std::vector< Attribute > active; //(per-instance "INSTANCE_*" attributes are left out, since the caller binds those)
+	};
+
+	std::unordered_map< GLuint, ProgramAttributes > &reflected_programs() {
+		static std::unordered_map< GLuint, ProgramAttributes > cache; //(only used on the GL thread)
+		return cache;
+	}
+
+	ProgramAttributes const &reflect_attributes(GLuint program) {
+		auto &cache = reflected_programs();
+		auto f = cache.find(program);
+		if (f != cache.end()) return f->second;
+
+		ProgramAttributes &attributes = cache[program];
+		GLint active = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
+		assert(active >= 0 && "Doesn't makes sense to have negative active attributes.");
+		for (GLuint i = 0; i < GLuint(active); ++i) {
+			GLchar name[100];
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
+			name[99] = '\0';
+			if (std::string(name).compare(0, 9, "INSTANCE_") == 0) continue;
+			attributes.active.emplace_back(ProgramAttributes::Attribute{name, glGetAttribLocation(program, name)});
+		}
+		return attributes;
+	}
+}
+
+void MeshBuffer::forget_program(GLuint program) {
+	reflected_programs().erase(program);
 }
 
 GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
-	//create a new vertex array object:
-	GLuint vao = 0;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	//Try to bind all attributes in this buffer:
-	std::set< GLuint > bound;
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	auto bind_attribute = [&](char const *name, MeshBuffer::Attrib const &attrib) {
-		if (attrib.size == 0) return; //don't bind empty attribs
-		GLint location = glGetAttribLocation(program, name);
-		if (location == -1) return; //can't bind missing attribs
-		glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, attrib.stride, (GLbyte *)0 + attrib.offset);
-		glEnableVertexAttribArray(location);
-		bound.insert(location);
+	ProgramAttributes const &attributes = reflect_attributes(program);
+
+	//Figure out where each attribute in this buffer goes:
+	enum : uint32_t { AttribCount = 5 };
+	Attrib const *attribs[AttribCount] = { &Position, &Normal, &NormalOct, &Color, &TexCoord };
+	static char const *names[AttribCount] = { "Position", "Normal", "NormalOct", "Color", "TexCoord" };
+	GLint locations[AttribCount]; //(-1 for attributes that won't be bound)
+	for (uint32_t a = 0; a < AttribCount; ++a) {
+		locations[a] = -1;
+		if (attribs[a]->size == 0) continue; //don't bind empty attribs
+		for (auto const &attribute : attributes.active) {
+			if (attribute.name == names[a]) locations[a] = attribute.location;
+		}
+	}
+
+	//Check that all active attributes will be bound:
+	auto bound = [&locations](GLint location) {
+		return std::find(locations, locations + AttribCount, location) != locations + AttribCount;
 	};
-	bind_attribute("Position", Position);
-	bind_attribute("Normal", Normal);
-	bind_attribute("Color", Color);
-	bind_attribute("TexCoord", TexCoord);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	//Check that all active attributes were bound:
-	GLint active = 0;
-	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
-	assert(active >= 0 && "Doesn't makes sense to have negative active attributes.");
-	for (GLuint i = 0; i < GLuint(active); ++i) {
-		GLchar name[100];
-		GLint size = 0;
-		GLenum type = 0;
-		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
-		name[99] = '\0';
-		GLint location = glGetAttribLocation(program, name);
-		if (!bound.count(GLuint(location))) {
-			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
+	auto location_of = [&attributes](char const *name) {
+		for (auto const &attribute : attributes.active) {
+			if (attribute.name == name) return attribute.location;
+		}
+		return GLint(-1);
+	};
+	for (auto const &attribute : attributes.active) {
+		//programs that handle both layouts take either Normal or NormalOct (only one will be in the buffer):
+		if (attribute.name == "Normal" && location_of("NormalOct") != -1 && bound(location_of("NormalOct"))) continue;
+		if (attribute.name == "NormalOct" && location_of("Normal") != -1 && bound(location_of("Normal"))) continue;
+		if (!bound(attribute.location)) {
+			throw std::runtime_error("ERROR: active attribute '" + attribute.name + "' in program is not bound.");
 		}
 	}
 
-	return vao;
+	//Every buffer with this vertex layout shares the arena's vertex array object for these locations:
+	GeometryArena::Layout layout;
+	layout.stride = Position.stride;
+	for (uint32_t a = 0; a < AttribCount; ++a) {
+		if (locations[a] == -1) continue; //can't bind missing attribs
+		Attrib const &attrib = *attribs[a];
+		assert(attrib.stride == layout.stride);
+		GeometryArena::Binding binding;
+		binding.location = GLuint(locations[a]);
+		binding.size = attrib.size;
+		binding.type = attrib.type;
+		binding.normalized = attrib.normalized;
+		binding.offset = attrib.offset;
+		layout.bindings.emplace_back(binding);
+	}
+	return GeometryArena::get().vao_for(layout);
 }
@@ -4,24 +4,70 @@
  * In this code, "Mesh" is a range of vertices that should be sent through
  *  the OpenGL pipeline together.
  * A "MeshBuffer" holds a collection of such meshes (loaded from a file) in
- *  a single OpenGL array buffer. Individual meshes can be looked up by name
+ *  a range of the shared GeometryArena vertex buffer. Individual meshes can be looked up by name
  *  using the MeshBuffer::lookup() function.
  *
+ * Files may be indexed (see cook-meshes.cpp, which welds duplicate vertices):
+ *  then each mesh is a range of 16- or 32-bit element indices in an element buffer.
+ *
+ * Files may also use a compact, quantized vertex layout (cook-meshes --quantize), 20 bytes rather than 36:
+ *  positions are 16-bit fractions of each mesh's bounding box, normals are octahedral-encoded in two 16-bit
+ *  values (bound to "NormalOct" instead of "Normal"), and texture coordinates are half floats.
+ *  Shaders dequantize positions with Mesh::dequantize and decode NormalOct themselves.
+ *
+ * Meshes named "<name>.lod1", "<name>.lod2", ... are simplified versions of "<name>" (see cook-meshes --lods)
+ *  and are listed in that mesh's Mesh::lods, coarsest last, for Scene::draw to switch between by projected size.
+ *  (an optional "lod0" chunk holds each mesh's switch size; without it, level N is used below 1/2^N of the viewport)
+ *
+ * Indexed files may also split meshes into meshlets (see Meshlet.hpp and cook-meshes --meshlets),
+ *  stored in an "mlt0" chunk sorted by element index.
+ *
  */
 
 #include "GL.hpp"
+#include "GeometryArena.hpp"
+#include "Meshlet.hpp"
 #include <glm/glm.hpp>
 #include <map>
 #include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
+	// (once the MeshBuffer is uploaded, 'start' and 'index_start' count from the start of the GeometryArena's buffers)
 
 	GLenum type = GL_TRIANGLES; //type of primitives in mesh
 	GLuint start = 0; //index of first vertex
-	GLuint count = 0; //count of vertices
+	GLuint count = 0; //count of vertices (or, for indexed meshes, of element indices)
+
+	//Indexed meshes draw 'count' element indices from the GeometryArena's element buffer, starting at 'index_start',
+	// with 'start' added to each (i.e., glDrawElementsBaseVertex):
+	GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT for indexed meshes
+	GLuint index_start = 0; //index of first element index
+
+	//Quantized meshes store positions as 16-bit fractions of their bounding box;
+	// this maps those [0,1]^3 positions to object space (and is the identity for meshes with float positions):
+	glm::mat4x3 dequantize = glm::mat4x3(1.0f);
+
+	//Lower levels of detail (the meshes named "<name>.lodN"), coarsest last:
+	// each may be drawn instead of this mesh once its bounding sphere's projected height is below
+	// 'max_size' (as a fraction of the viewport height; see Scene::Drawable::Pipeline::lods)
+	struct LOD {
+		GLuint start = 0;
+		GLuint count = 0;
+		GLuint index_start = 0;
+		glm::mat4x3 dequantize = glm::mat4x3(1.0f);
+		float max_size = 0.0f;
+	};
+	std::vector< LOD > lods;
+
+	//Meshlets (optional; indexed meshes only) covering this mesh's element indices, in order:
+	// (points into MeshBuffer::meshlets)
+	Meshlet const *meshlets = nullptr;
+	uint32_t meshlet_count = 0;
 
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
@@ -34,22 +80,62 @@ struct MeshBuffer {
 	// note: will throw if file fails to read.
 	MeshBuffer(std::string const &filename);
 
+	//two-phase construction: read and parse the file without any OpenGL calls (so it is safe on any thread),
+	// then call upload() on the GL thread before drawing its meshes or calling make_vao_for_program():
+	enum DeferUpload_t { DeferUpload };
+	MeshBuffer(std::string const &filename, DeferUpload_t);
+	void upload();
+
+	~MeshBuffer();
+
+	//append a mesh's triangles (three object-space corner positions each) to 'corners', for CPU-side queries like picking:
+	// note: must be called before upload(), which releases the file's data.
+	void read_triangles(Mesh const &mesh, std::vector< glm::vec3 > *corners) const;
+	//..same, but append the vertex each corner uses (an index into the file's vertices), e.g., to check a mesh's connectivity:
+	void read_triangle_vertices(Mesh const &mesh, std::vector< uint32_t > *vertices) const;
+
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
 	
-	//build a vertex array object that links this vbo to attributes to a program:
+	//get a vertex array object that links this vbo to attributes to a program:
 	// note: will throw if program defines attributes not contained in this buffer
+	//  (except for per-instance attributes, named "INSTANCE_*", which are left for the caller to bind)
+	// note: the vao belongs to the GeometryArena, and is shared with every MeshBuffer with the same vertex layout
+	//  (it depends only on the layout and attribute locations, not on the program, so it stays valid after the program is deleted)
+	// note: each program's active attributes are queried once and cached by program name
 	GLuint make_vao_for_program(GLuint program) const;
 
-	//This is the OpenGL vertex buffer object containing the mesh data:
-	GLuint buffer = 0;
+	//drop the cached attributes of a program (call before deleting a program passed to make_vao_for_program, since GL reuses names):
+	static void forget_program(GLuint program);
+
+	//The ranges of the GeometryArena's vertex buffer and element index buffer that hold the mesh data:
+	// (the index range is empty if the file isn't indexed)
+	GeometryArena::Range vertices;
+	GeometryArena::Range indices;
 
 	//-- internals ---
 
-	//used by the lookup() function:
+	//every mesh, by name (ordered, for code that wants to step through them):
 	std::map< std::string, Mesh > meshes;
 
+	//used by the lookup() function: an open-addressing (linear probing) hash table over 'meshes',
+	// built once the file is read (so call build_name_table() again after changing 'meshes'):
+	struct NameSlot {
+		uint64_t hash = 0;
+		std::pair< const std::string, Mesh > const *entry = nullptr; //(nullptr for empty slots)
+	};
+	std::vector< NameSlot > name_table; //size is zero or a power of two
+	void build_name_table();
+	static uint64_t hash_name(std::string const &name);
+
+	//every mesh's meshlets (from the file's mlt0 chunk, if any), sorted by index_begin:
+	std::vector< Meshlet > meshlets;
+
+	//vertex data read by a deferred constructor, kept (in the still-mapped file) until upload():
+	struct Pending;
+	std::unique_ptr< Pending > pending;
+
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
 		GLint size = 0;
@@ -65,6 +151,7 @@ struct MeshBuffer {
 
 	Attrib Position;
 	Attrib Normal;
+	Attrib NormalOct; //(quantized buffers have this instead of Normal)
 	Attrib Color;
 	Attrib TexCoord;
 };
@@ -0,0 +1,35 @@
+#pragma once
+
+/*
+ * A "Meshlet" is a small cluster of an indexed mesh's triangles (up to about 128),
+ *  stored as a contiguous range of the mesh's element indices, with bounds for culling:
+ *  - a bounding sphere around the cluster's vertices
+ *  - a cone around the cluster's triangle normals
+ *
+ * Scene::draw skips meshlets that are outside the view frustum (and, if back faces are culled,
+ *  meshlets whose triangles all face away from the camera), and draws the rest with one
+ *  glMultiDrawElementsBaseVertex call.
+ *
+ * Meshlets are written by cook-meshes --meshlets (as an "mlt0" chunk; see Mesh.hpp).
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+struct Meshlet {
+	uint32_t index_begin, index_end; //range of element indices (in the MeshBuffer's index buffer)
+
+	//bounding sphere (in the mesh's object space):
+	glm::vec3 center;
+	float radius;
+
+	//normal cone (in the mesh's object space):
+	// every triangle faces away from any camera position 'eye' where
+	//   dot(center - eye, cone_axis) >= cone_cutoff * length(center - eye) + radius
+	// (cone_cutoff is the sine of the cone's half-angle, or 1 if the normals are too spread out for this to ever hold)
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+static_assert(sizeof(Meshlet) == 4*2 + 4*4 + 4*4, "Meshlet is packed.");
@@ -13,13 +13,18 @@
 #include <random>
 
 GLuint hexapod_meshes_for_lit_color_texture_program = 0;
-Load< MeshBuffer > hexapod_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("cube_example.pnct"));
-	hexapod_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+GLuint hexapod_meshes_for_lit_color_texture_program_instanced = 0;
+//(the file is read on a worker thread; only the upload and VAO creation happen on the GL thread)
+Load< MeshBuffer > hexapod_meshes("hexapod_meshes", LoadTagDefault, []() -> MeshBuffer * {
+	return new MeshBuffer(data_path("cube_example.pnct"), MeshBuffer::DeferUpload);
+}, [](MeshBuffer &meshes) {
+	meshes.upload();
+	hexapod_meshes_for_lit_color_texture_program = meshes.make_vao_for_program(lit_color_texture_program->program);
+	hexapod_meshes_for_lit_color_texture_program_instanced = meshes.make_vao_for_program(lit_color_texture_program_instanced->program);
 });
 
-Load< Scene > hexapod_scene(LoadTagDefault, []() -> Scene const * {
+//(parsing the scene doesn't touch OpenGL, so it can happen on a worker thread once the meshes are loaded)
+Load< Scene > hexapod_scene("hexapod_scene", LoadTagDefault, []() -> Scene const * {
 	return new Scene(data_path("cube_example.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 		Mesh const &mesh = hexapod_meshes->lookup(mesh_name);
 
@@ -29,12 +34,28 @@ Load< Scene > hexapod_scene(LoadTagDefault, []() -> Scene const * {
 		drawable.pipeline = lit_color_texture_program_pipeline;
 
 		drawable.pipeline.vao = hexapod_meshes_for_lit_color_texture_program;
+		drawable.pipeline.instanced_vao = hexapod_meshes_for_lit_color_texture_program_instanced;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.index_start = mesh.index_start;
+		drawable.pipeline.dequantize = mesh.dequantize;
+		drawable.pipeline.meshlets = mesh.meshlets;
+		drawable.pipeline.meshlet_count = mesh.meshlet_count;
+		for (uint32_t l = 0; l < mesh.lods.size() && l < Scene::Drawable::Pipeline::MaxLODs; ++l) {
+			drawable.pipeline.lods[l].start = mesh.lods[l].start;
+			drawable.pipeline.lods[l].count = mesh.lods[l].count;
+			drawable.pipeline.lods[l].index_start = mesh.lods[l].index_start;
+			drawable.pipeline.lods[l].dequantize = mesh.lods[l].dequantize;
+			drawable.pipeline.lods[l].max_size = mesh.lods[l].max_size;
+		}
+
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
 
 	});
-});
+}, LoadOnAnyThread, { &hexapod_meshes });
 
 PlayMode::PlayMode() : scene(*hexapod_scene) {
 	//get pointers to leg for convenience:
@@ -177,14 +198,6 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	glUseProgram(0);
-
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
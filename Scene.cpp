@@ -2,10 +2,24 @@
 
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
+#include "Load.hpp"
+#include "WorkerPool.hpp"
+#include "LightClusters.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SCENE_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 //-------------------------
 
@@ -56,19 +70,134 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	);
 }
 
-glm::mat4x3 Scene::Transform::make_local_to_world() const {
+void Scene::Transform::update_world_cache() const {
+	if (parent) parent->update_world_cache();
+	refresh_world_cache();
+}
+
+void Scene::Transform::refresh_world_cache() const {
+	if (!world_cache_dirty()) return;
+
 	if (!parent) {
-		return make_local_to_parent();
+		store_world_cache(make_local_to_parent());
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		store_world_cache(parent->world_cache.local_to_world * glm::mat4(make_local_to_parent())); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
 	}
 }
+
+bool Scene::Transform::world_cache_dirty() const {
+	//check if anything the cached matrix depends on has changed:
+	return !(world_cache.version != 0
+	 && world_cache.position == position
+	 && world_cache.rotation == rotation
+	 && world_cache.scale == scale
+	 && world_cache.parent == parent
+	 && (!parent || world_cache.parent_version == parent->world_cache.version));
+}
+
+void Scene::Transform::store_world_cache(glm::mat4x3 const &local_to_world) const {
+	world_cache.local_to_world = local_to_world;
+
+	world_cache.position = position;
+	world_cache.rotation = rotation;
+	world_cache.scale = scale;
+	world_cache.parent = parent;
+	world_cache.parent_version = (parent ? parent->world_cache.version : 0);
+	world_cache.has_world_to_local = false;
+
+	//bump version so children know to rebuild (skipping the "never built" value on wrap-around):
+	world_cache.version += 1;
+	if (world_cache.version == 0) world_cache.version = 1;
+}
+
+glm::mat4x3 Scene::Transform::make_local_to_world() const {
+	update_world_cache();
+	return world_cache.local_to_world;
+}
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
-	if (!parent) {
-		return make_parent_to_local();
-	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+	update_world_cache();
+	if (!world_cache.has_world_to_local) {
+		if (!parent) {
+			world_cache.world_to_local = make_parent_to_local();
+		} else {
+			world_cache.world_to_local = make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		}
+		world_cache.has_world_to_local = true;
+	}
+	return world_cache.world_to_local;
+}
+
+//-------------------------
+
+Scene::Transform &Scene::TransformArray::emplace_back() {
+	if (count == blocks.size() * BlockSize) {
+		//allocate raw storage for another block; transforms are constructed in place as they are added:
+		blocks.emplace_back(static_cast< Transform * >(::operator new(sizeof(Transform) * BlockSize)));
+	}
+	Transform *transform = new (&blocks[count / BlockSize][count % BlockSize]) Transform();
+	transform->array_index = uint32_t(count);
+	count += 1;
+	return *transform;
+}
+
+void Scene::TransformArray::clear() {
+	for (size_t i = 0; i < count; ++i) {
+		(*this)[i].~Transform();
+	}
+	for (auto block : blocks) {
+		::operator delete(block);
+	}
+	blocks.clear();
+	count = 0;
+	parent_indices.clear();
+	level_order.clear();
+	level_begin.clear();
+	locals = Locals();
+}
+
+void Scene::TransformArray::update_parent_indices() {
+	parent_indices.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		parent_indices[i] = index_of((*this)[i].parent);
+	}
+}
+
+bool Scene::TransformArray::update_depth_levels() {
+	assert(parent_indices.size() == count);
+	level_order.clear();
+	level_begin.clear();
+
+	//depth of every transform (parents come first, so one pass suffices):
+	std::vector< uint32_t > depths(count);
+	uint32_t max_depth = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		Transform const &transform = (*this)[i];
+		uint32_t parent_index = parent_indices[i];
+		if (parent_index < i) {
+			depths[i] = depths[parent_index] + 1;
+		} else if (!transform.parent) {
+			depths[i] = 0;
+		} else {
+			//parent is stored later or elsewhere; levels can't capture that ordering:
+			return false;
+		}
+		max_depth = std::max(max_depth, depths[i]);
 	}
+
+	//counting sort by depth:
+	level_begin.assign(count ? max_depth + 2 : 1, 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		level_begin[depths[i] + 1] += 1;
+	}
+	for (uint32_t d = 1; d < level_begin.size(); ++d) {
+		level_begin[d] += level_begin[d-1];
+	}
+	level_order.resize(count);
+	std::vector< uint32_t > next(level_begin.begin(), level_begin.end() - 1);
+	for (uint32_t i = 0; i < count; ++i) {
+		level_order[next[depths[i]]++] = i;
+	}
+	return true;
 }
 
 //-------------------------
@@ -79,6 +208,60 @@ glm::mat4 Scene::Camera::make_projection() const {
 
 //-------------------------
 
+//All scenes share buffers for per-instance data and uniform blocks, (re-)filled on each draw():
+//n.b. declared static so they don't conflict with similarly named global variables elsewhere:
+static GLuint instance_buffer = 0;
+static GLuint frame_block_buffer = 0;
+static GLuint object_block_buffer = 0;
+static GLsizeiptr object_block_stride = 0; //sizeof(ObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+static Load< void > setup_scene_buffers("Scene buffers", LoadTagDefault, [](){
+	glGenBuffers(1, &instance_buffer);
+	glGenBuffers(1, &frame_block_buffer);
+	glGenBuffers(1, &object_block_buffer);
+	//buffers will be filled in Scene::draw.
+
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	object_block_stride = (sizeof(Scene::ObjectBlock) + alignment - 1) / alignment * alignment;
+
+	GL_ERRORS();
+});
+
+void Scene::Drawable::make_world_box(glm::mat4x3 const &local_to_world, glm::vec3 *world_min, glm::vec3 *world_max) const {
+	glm::vec3 center = local_to_world * glm::vec4(0.5f * (min + max), 1.0f);
+	glm::vec3 radius = 0.5f * (max - min);
+	//extent along each world axis is the sum of the (absolute) contributions of each local axis:
+	glm::vec3 extent = glm::abs(local_to_world[0]) * radius.x
+	                 + glm::abs(local_to_world[1]) * radius.y
+	                 + glm::abs(local_to_world[2]) * radius.z;
+	*world_min = center - extent;
+	*world_max = center + extent;
+}
+
+//is the box [min,max] entirely outside the clip volume of object_to_clip?
+// (the clip-space planes -w <= x,y,z <= w are pulled back into object space, so this handles rotated boxes exactly;
+//  an infinite far plane -- as from Camera::make_projection -- comes out as (0,0,0,+) and never culls anything)
+static bool outside_clip_volume(glm::mat4 const &object_to_clip, glm::vec3 const &min, glm::vec3 const &max) {
+	//rows of object_to_clip:
+	glm::vec4 r0 = glm::vec4(object_to_clip[0][0], object_to_clip[1][0], object_to_clip[2][0], object_to_clip[3][0]);
+	glm::vec4 r1 = glm::vec4(object_to_clip[0][1], object_to_clip[1][1], object_to_clip[2][1], object_to_clip[3][1]);
+	glm::vec4 r2 = glm::vec4(object_to_clip[0][2], object_to_clip[1][2], object_to_clip[2][2], object_to_clip[3][2]);
+	glm::vec4 r3 = glm::vec4(object_to_clip[0][3], object_to_clip[1][3], object_to_clip[2][3], object_to_clip[3][3]);
+
+	glm::vec4 planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+	for (auto const &plane : planes) {
+		//box corner furthest along the plane normal:
+		glm::vec3 corner = glm::vec3(
+			(plane.x > 0.0f ? max.x : min.x),
+			(plane.y > 0.0f ? max.y : min.y),
+			(plane.z > 0.0f ? max.z : min.z)
+		);
+		if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f) return true;
+	}
+	return false;
+}
 
 void Scene::draw(Camera const &camera) const {
 	assert(camera.transform);
@@ -88,11 +271,16 @@ void Scene::draw(Camera const &camera) const {
 }
 
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	typedef Drawable::Pipeline Pipeline;
+
+	draw_stats = DrawStats();
 
-	//Iterate through all drawables, sending each one to OpenGL:
+	//Gather drawables that can actually be drawn:
+	render_queue.clear();
+	uint32_t order = 0;
 	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+		Pipeline const &pipeline = drawable.pipeline;
+		order += 1;
 
 		//skip any drawables without a shader program set:
 		if (pipeline.program == 0) continue;
@@ -101,78 +289,835 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
 
+		assert(drawable.transform); //drawables *must* have a transform
+		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+		//skip any drawables that are entirely outside the view:
+		if (drawable.min.x <= drawable.max.x) {
+			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+			if (outside_clip_volume(object_to_clip, drawable.min, drawable.max)) {
+				draw_stats.culled += 1;
+				continue;
+			}
+		}
+		draw_stats.drawn += 1;
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		render_queue.emplace_back(RenderItem{&drawable, order, object_to_world});
+	}
 
-		//Configure program uniforms:
+	draw_render_queue(world_to_clip, world_to_light);
+}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+void Scene::draw(std::vector< Drawable const * > const &visible, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	draw_stats = DrawStats();
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+	//Gather drawables that can actually be drawn (visibility was already decided by the caller):
+	render_queue.clear();
+	uint32_t order = 0;
+	for (Drawable const *drawable : visible) {
+		assert(drawable);
+		Drawable::Pipeline const &pipeline = drawable->pipeline;
+		order += 1;
+
+		if (pipeline.program == 0) continue;
+		if (pipeline.vao == 0) continue;
+		if (pipeline.count == 0) continue;
+
+		draw_stats.drawn += 1;
+
+		assert(drawable->transform); //drawables *must* have a transform
+		render_queue.emplace_back(RenderItem{drawable, order, drawable->transform->make_local_to_world()});
+	}
+
+	draw_render_queue(world_to_clip, world_to_light);
+}
+
+glm::ivec4 Scene::select_lights(Drawable const &drawable, glm::mat4x3 const &object_to_world) const {
+	//world-space box to measure light distances against (a point, for drawables without bounds):
+	glm::vec3 box_min = object_to_world[3];
+	glm::vec3 box_max = object_to_world[3];
+	if (drawable.min.x <= drawable.max.x) {
+		drawable.make_world_box(object_to_world, &box_min, &box_max);
+	}
+
+	//keep the MaxObjectLights highest-scoring lights, in decreasing order of score:
+	glm::ivec4 best = glm::ivec4(-1);
+	float best_score[MaxObjectLights];
+	for (uint32_t i = 0; i < active_lights.size(); ++i) {
+		ActiveLight const &light = active_lights[i];
+		float score;
+		if (light.type == Light::Point || light.type == Light::Spot) {
+			//energy arriving at the nearest point of the box (matching the shader's falloff):
+			glm::vec3 to_box = glm::clamp(light.position, box_min, box_max) - light.position;
+			float dis2 = glm::dot(to_box, to_box);
+			if (light.distance > 0.0f && dis2 > light.distance * light.distance) continue;
+			score = light.strength / std::max(1.0f, dis2);
+		} else {
+			//hemisphere and directional lights reach everything:
+			score = light.strength;
 		}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+		uint32_t slot = MaxObjectLights;
+		while (slot > 0 && (best[slot-1] == -1 || best_score[slot-1] < score)) --slot;
+		if (slot == MaxObjectLights) continue;
+		for (uint32_t j = MaxObjectLights - 1; j > slot; --j) {
+			best[j] = best[j-1];
+			best_score[j] = best_score[j-1];
+		}
+		best[slot] = int32_t(i);
+		best_score[slot] = score;
+	}
+	return best;
+}
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+//the vertex range a render item draws -- its pipeline's own, or the level of detail draw() picked:
+namespace {
+	struct DrawRange {
+		GLuint start;
+		GLuint count;
+		GLuint index_start;
+		glm::mat4x3 const *dequantize;
+	};
+}
+static DrawRange draw_range(Scene::RenderItem const &item) {
+	Scene::Drawable::Pipeline const &pipeline = item.drawable->pipeline;
+	if (item.lod == 0) return DrawRange{pipeline.start, pipeline.count, pipeline.index_start, &pipeline.dequantize};
+	Scene::Drawable::Pipeline::LOD const &lod = pipeline.lods[item.lod - 1];
+	return DrawRange{lod.start, lod.count, lod.index_start, &lod.dequantize};
+}
+
+//decides which meshlets of a mesh can be seen (all in the mesh's object space, so meshlets never need transforming):
+namespace {
+	struct MeshletCuller {
+		glm::vec4 planes[6]; //frustum planes with unit-length normals ((0,0,0,1) for planes at infinity)
+		bool cull_back_facing = false;
+		glm::vec3 eye = glm::vec3(0.0f); //camera position
+
+		MeshletCuller(glm::mat4 const &object_to_clip, bool back_faces_culled) {
+			//rows of object_to_clip:
+			glm::vec4 r0 = glm::vec4(object_to_clip[0][0], object_to_clip[1][0], object_to_clip[2][0], object_to_clip[3][0]);
+			glm::vec4 r1 = glm::vec4(object_to_clip[0][1], object_to_clip[1][1], object_to_clip[2][1], object_to_clip[3][1]);
+			glm::vec4 r2 = glm::vec4(object_to_clip[0][2], object_to_clip[1][2], object_to_clip[2][2], object_to_clip[3][2]);
+			glm::vec4 r3 = glm::vec4(object_to_clip[0][3], object_to_clip[1][3], object_to_clip[2][3], object_to_clip[3][3]);
+
+			glm::vec4 clip_planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+			for (uint32_t i = 0; i < 6; ++i) {
+				float length = glm::length(glm::vec3(clip_planes[i]));
+				planes[i] = (length > 0.0f ? clip_planes[i] / length : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			}
+
+			//the camera is the point that projects to x = y = w = 0 (solved by Cramer's rule; no such point for orthographic views):
+			if (back_faces_culled) {
+				glm::vec3 a0 = glm::vec3(r0), a1 = glm::vec3(r1), a2 = glm::vec3(r3);
+				float det = glm::dot(a0, glm::cross(a1, a2));
+				if (std::abs(det) > 1e-12f) {
+					eye = -(r0.w * glm::cross(a1, a2) + r1.w * glm::cross(a2, a0) + r3.w * glm::cross(a0, a1)) / det;
+					cull_back_facing = true;
+				}
+			}
 		}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+		bool culled(Meshlet const &meshlet) const {
+			for (auto const &plane : planes) {
+				if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w < -meshlet.radius) return true;
+			}
+			if (cull_back_facing) {
+				glm::vec3 to_center = meshlet.center - eye;
+				if (glm::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius) return true;
+			}
+			return false;
 		}
+	};
+}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+void Scene::draw_render_queue(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	typedef Drawable::Pipeline Pipeline;
+
+	//Pick levels of detail from projected size:
+	// (the projected height of a sphere of radius r at view depth w is about r * y_scale / w of the viewport,
+	//  where y_scale is the length of the first three entries of world_to_clip's second row -- the projection's
+	//  vertical scale, since world-to-camera is a rigid transform)
+	{
+		glm::vec3 y_row = glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1]);
+		glm::vec4 w_row = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+		float y_scale = glm::length(y_row);
+		for (auto &item : render_queue) {
+			Drawable const &drawable = *item.drawable;
+			Pipeline const &pipeline = drawable.pipeline;
+			if (pipeline.lods[0].count == 0 || !(drawable.min.x <= drawable.max.x)) continue;
+
+			glm::mat4x3 const &local_to_world = item.object_to_world;
+			glm::vec3 center = local_to_world * glm::vec4(0.5f * (drawable.min + drawable.max), 1.0f);
+			float scale = std::max(glm::length(local_to_world[0]), std::max(glm::length(local_to_world[1]), glm::length(local_to_world[2])));
+			float radius = 0.5f * glm::length(drawable.max - drawable.min) * scale;
+			float w = glm::dot(glm::vec3(w_row), center) + w_row.w;
+			if (w <= radius) continue; //(camera is inside the sphere)
+			float size = lod_scale * radius * y_scale / w;
+
+			for (uint32_t l = 0; l < Pipeline::MaxLODs; ++l) {
+				if (pipeline.lods[l].count == 0) break;
+				if (size < pipeline.lods[l].max_size) item.lod = l + 1;
+			}
+			if (item.lod) draw_stats.lod_reduced += 1;
+		}
+	}
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
+	//Sort so drawables sharing a program, then vertex array, then textures are adjacent:
+	auto state_less = [](RenderItem const &a, RenderItem const &b) {
+		Pipeline const &pa = a.drawable->pipeline;
+		Pipeline const &pb = b.drawable->pipeline;
+		DrawRange ra = draw_range(a);
+		DrawRange rb = draw_range(b);
+		if (pa.program != pb.program) return pa.program < pb.program;
+		if (pa.vao != pb.vao) return pa.vao < pb.vao;
+		for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+			if (pa.textures[i].texture != pb.textures[i].texture) return pa.textures[i].texture < pb.textures[i].texture;
+			if (pa.textures[i].target != pb.textures[i].target) return pa.textures[i].target < pb.textures[i].target;
+		}
+		if (pa.cull_back_faces != pb.cull_back_faces) return pa.cull_back_faces < pb.cull_back_faces;
+		if (pa.type != pb.type) return pa.type < pb.type;
+		//(sorting by vertex range keeps drawables that can be instanced together adjacent)
+		if (ra.start != rb.start) return ra.start < rb.start;
+		if (ra.count != rb.count) return ra.count < rb.count;
+		if (pa.index_type != pb.index_type) return pa.index_type < pb.index_type;
+		if (ra.index_start != rb.index_start) return ra.index_start < rb.index_start;
+		return a.order < b.order;
+	};
+	// ...but only within runs between keep_order drawables, which stay where they are in the list:
+	auto run_begin = render_queue.begin();
+	for (auto it = render_queue.begin(); ; ++it) {
+		if (it == render_queue.end() || it->drawable->pipeline.keep_order) {
+			std::sort(run_begin, it, state_less);
+			if (it == render_queue.end()) break;
+			run_begin = it + 1;
+		}
+	}
+
+	//Gather the lights for the FRAME block (n.b. before instance data, which references them):
+	FrameBlock frame;
+	frame.WORLD_TO_CLIP = world_to_clip;
+	frame.WORLD_TO_LIGHT = glm::mat4(world_to_light);
+	frame.LIGHT_COUNT = 0;
+	active_lights.clear();
+	for (auto const &light : lights) {
+		if (active_lights.size() == MaxLights) break;
+		assert(light.transform); //lights *must* have a transform
+		glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+
+		ActiveLight active;
+		active.type = light.type;
+		active.position = light_to_world[3];
+		active.distance = light.distance;
+		active.strength = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+		active_lights.emplace_back(active);
+
+		LightInfo &info = frame.LIGHTS[frame.LIGHT_COUNT++];
+		switch (light.type) {
+			case Light::Point: info.TYPE = 0; break;
+			case Light::Hemisphere: info.TYPE = 1; break;
+			case Light::Spot: info.TYPE = 2; break;
+			case Light::Directional: info.TYPE = 3; break;
+		}
+		info.LOCATION = world_to_light * glm::vec4(active.position, 1.0f);
+		info.DIRECTION = glm::normalize(glm::mat3(world_to_light) * -light_to_world[2]);
+		info.CUTOFF = std::cos(0.5f * light.spot_fov);
+		info.ENERGY = light.energy;
+		info.RADIUS = light.distance;
+	}
+	if (active_lights.empty()) {
+		//no lights in the scene -- use a default so things aren't just black:
+		ActiveLight active;
+		active.type = Light::Hemisphere;
+		active.position = glm::vec3(0.0f);
+		active.distance = 0.0f;
+		active.strength = 1.0f;
+		active_lights.emplace_back(active);
+
+		LightInfo &info = frame.LIGHTS[frame.LIGHT_COUNT++];
+		info.TYPE = 1;
+		info.LOCATION = glm::vec3(0.0f);
+		info.DIRECTION = glm::normalize(glm::mat3(world_to_light) * glm::vec3(0.0f, 0.0f,-1.0f));
+		info.CUTOFF = 0.0f;
+		info.ENERGY = glm::vec3(1.0f);
+		info.RADIUS = 0.0f;
+	}
+	if (light_clusters) {
+		LightClusters const &clusters = *light_clusters;
+		frame.CLUSTER_GRID = glm::ivec4(LightClusters::GridX, LightClusters::GridY, LightClusters::GridZ, clusters.global_count);
+		frame.CLUSTER_SCALE = glm::vec4(
+			float(LightClusters::GridX) / float(std::max(1U, clusters.drawable_size.x)),
+			float(LightClusters::GridY) / float(std::max(1U, clusters.drawable_size.y)),
+			clusters.near,
+			float(LightClusters::GridZ) / std::log(clusters.far / clusters.near)
+		);
+		clusters.bind();
+	} else {
+		frame.CLUSTER_GRID = glm::ivec4(0);
+		frame.CLUSTER_SCALE = glm::vec4(0.0f);
+	}
+
+	//Find runs of drawables that can share an instanced draw and collect their matrices:
+	instance_data.clear();
+	auto instanceable = [](Pipeline const &pipeline) {
+		return pipeline.instanced_program != 0
+		    && pipeline.instanced_vao != 0
+		    && pipeline.INSTANCE_TO_WORLD_mat4x3 != -1U
+		    && !pipeline.set_uniforms;
+	};
+	auto same_instance = [](RenderItem const &item_a, RenderItem const &item_b) {
+		Pipeline const &a = item_a.drawable->pipeline;
+		Pipeline const &b = item_b.drawable->pipeline;
+		DrawRange ra = draw_range(item_a);
+		DrawRange rb = draw_range(item_b);
+		if (a.program != b.program || a.instanced_program != b.instanced_program) return false;
+		if (a.vao != b.vao || a.instanced_vao != b.instanced_vao) return false;
+		if (a.cull_back_faces != b.cull_back_faces) return false;
+		if (a.type != b.type || ra.start != rb.start || ra.count != rb.count) return false;
+		if (a.index_type != b.index_type || ra.index_start != rb.index_start) return false;
+		for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+			if (a.textures[i].texture != b.textures[i].texture || a.textures[i].target != b.textures[i].target) return false;
+		}
+		return true;
+	};
+	auto mirrored = [](glm::mat4x3 const &object_to_world) {
+		return glm::dot(object_to_world[0], glm::cross(object_to_world[1], object_to_world[2])) < 0.0f;
+	};
+	for (size_t begin = 0; begin < render_queue.size(); ) {
+		Pipeline const &first = render_queue[begin].drawable->pipeline;
+		size_t end = begin + 1;
+		if (instanceable(first)) {
+			while (end < render_queue.size()
+			 && instanceable(render_queue[end].drawable->pipeline)
+			 && same_instance(render_queue[begin], render_queue[end])) {
+				++end;
+			}
+		}
+		if (end - begin >= MinInstances) {
+			render_queue[begin].instance_count = uint32_t(end - begin);
+			render_queue[begin].instance_first = uint32_t(instance_data.size());
+			uint32_t mirrored_count = 0;
+			for (size_t i = begin; i < end; ++i) {
+				InstanceData instance;
+				instance.object_to_world = render_queue[i].object_to_world;
+				instance.lights = select_lights(*render_queue[i].drawable, instance.object_to_world);
+				instance_data.emplace_back(instance);
+				if (mirrored(instance.object_to_world)) mirrored_count += 1;
+			}
+			//(one draw has one front face, so runs mixing mirrored and unmirrored instances draw both sides)
+			if (first.cull_back_faces) {
+				if (mirrored_count == 0) render_queue[begin].front_face = GL_CCW;
+				else if (mirrored_count == end - begin) render_queue[begin].front_face = GL_CW;
+			}
+		} else {
+			end = begin + 1;
+			if (first.cull_back_faces) {
+				render_queue[begin].front_face = (mirrored(render_queue[begin].object_to_world) ? GL_CW : GL_CCW);
+			}
+		}
+		begin = end;
+	}
+
+	//Cull the meshlets of (non-instanced) drawables that have them, collecting the visible ranges of element indices:
+	multi_draw.counts.clear();
+	multi_draw.offsets.clear();
+	multi_draw.base_vertices.clear();
+	for (size_t q = 0; q < render_queue.size(); ++q) {
+		RenderItem &item = render_queue[q];
+		if (item.instance_count) {
+			q += item.instance_count - 1;
+			continue;
+		}
+		Pipeline const &pipeline = item.drawable->pipeline;
+		if (pipeline.meshlet_count == 0 || item.lod != 0) continue;
+		if (pipeline.index_type == GL_NONE || pipeline.type != GL_TRIANGLES) continue;
+
+		glm::mat4x3 const &object_to_world = item.object_to_world;
+		//(with the front face flipped for mirrored transforms, GL culls the faces that are back-facing in object space)
+		MeshletCuller culler(world_to_clip * glm::mat4(object_to_world), item.front_face != GL_NONE);
+
+		size_t index_size = (pipeline.index_type == GL_UNSIGNED_SHORT ? 2 : (pipeline.index_type == GL_UNSIGNED_BYTE ? 1 : 4));
+		item.multi_first = uint32_t(multi_draw.counts.size());
+		uint32_t range_end = -1U; //end of the last range added (so adjacent meshlets can extend it)
+		for (uint32_t m = 0; m < pipeline.meshlet_count; ++m) {
+			Meshlet const &meshlet = pipeline.meshlets[m];
+			if (culler.culled(meshlet)) {
+				draw_stats.meshlets_culled += 1;
+				continue;
+			}
+			draw_stats.meshlets_drawn += 1;
+			if (range_end == meshlet.index_begin) {
+				multi_draw.counts.back() += GLsizei(meshlet.index_end - meshlet.index_begin);
+			} else {
+				multi_draw.counts.emplace_back(GLsizei(meshlet.index_end - meshlet.index_begin));
+				multi_draw.offsets.emplace_back((GLvoid const *)((GLbyte const *)0 + meshlet.index_begin * index_size));
+				multi_draw.base_vertices.emplace_back(GLint(pipeline.start));
+			}
+			range_end = meshlet.index_end;
+		}
+		item.multi_count = uint32_t(multi_draw.counts.size()) - item.multi_first;
+	}
+
+	if (!instance_data.empty()) {
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(InstanceData), instance_data.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	{ //Upload the FRAME block:
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_block_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), &frame, GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FrameBlockBinding, frame_block_buffer);
+	}
+
+	//Compute OBJECT blocks for all (non-instanced) drawables that use them, and upload them together:
+	object_blocks.clear();
+	for (size_t q = 0; q < render_queue.size(); ++q) {
+		RenderItem &item = render_queue[q];
+		if (item.instance_count) {
+			q += item.instance_count - 1;
+			continue;
+		}
+		Pipeline const &pipeline = item.drawable->pipeline;
+		if (pipeline.OBJECT_block == -1U) continue;
+		if (item.multi_count == 0) continue; //(every meshlet was culled)
+		DrawRange range = draw_range(item);
+
+		glm::mat4x3 const &object_to_world = item.object_to_world;
+		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+		glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+
+		//(positions may be quantized; normals never are, so only the position matrices include 'dequantize')
+		glm::mat4 dequantize = glm::mat4(*range.dequantize);
+
+		ObjectBlock block;
+		block.OBJECT_TO_CLIP = world_to_clip * glm::mat4(object_to_world) * dequantize;
+		block.OBJECT_TO_LIGHT = glm::mat4(object_to_light) * dequantize;
+		block.NORMAL_TO_LIGHT[0] = glm::vec4(normal_to_light[0], 0.0f);
+		block.NORMAL_TO_LIGHT[1] = glm::vec4(normal_to_light[1], 0.0f);
+		block.NORMAL_TO_LIGHT[2] = glm::vec4(normal_to_light[2], 0.0f);
+		block.OBJECT_LIGHTS = select_lights(*item.drawable, object_to_world);
+
+		item.object_block = uint32_t(object_blocks.size() / object_block_stride);
+		object_blocks.resize(object_blocks.size() + object_block_stride);
+		std::memcpy(&object_blocks[item.object_block * object_block_stride], &block, sizeof(ObjectBlock));
+	}
+	if (!object_blocks.empty()) {
+		glBindBuffer(GL_UNIFORM_BUFFER, object_block_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, object_blocks.size(), object_blocks.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	//Track bound state so redundant binds can be skipped:
+	GLuint bound_program = 0;
+	GLuint bound_vao = 0;
+	Pipeline::TextureInfo bound_textures[Pipeline::TextureCount];
+
+	//byte offset of an indexed draw's first element index (as the pointer glDrawElements* expects):
+	auto index_offset = [](Pipeline const &pipeline, DrawRange const &range) {
+		size_t size = (pipeline.index_type == GL_UNSIGNED_SHORT ? 2 : (pipeline.index_type == GL_UNSIGNED_BYTE ? 1 : 4));
+		return (GLvoid const *)((GLbyte const *)0 + range.index_start * size);
+	};
+
+	//binds textures for a pipeline (textures stay bound between draws, so only changed units are re-bound):
+	// (units the pipeline doesn't use are un-bound, as they were when every draw un-bound its textures afterward)
+	uint32_t texture_unbinds = 0; //un-binds issued
+	uint32_t per_draw_unbinds = 0; //un-binds a loop that un-binds every texture after each draw would have issued
+	auto bind_textures = [&](Pipeline const &pipeline) {
+		for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+			if (pipeline.textures[i].texture == 0) {
+				if (bound_textures[i].texture != 0) {
+					glActiveTexture(GL_TEXTURE0 + i);
+					glBindTexture(bound_textures[i].target, 0);
+					bound_textures[i] = Pipeline::TextureInfo();
+					draw_stats.state_changes += 1;
+					texture_unbinds += 1;
+				}
+				continue;
+			}
+			per_draw_unbinds += 1;
+			if (pipeline.textures[i].texture != bound_textures[i].texture || pipeline.textures[i].target != bound_textures[i].target) {
 				glActiveTexture(GL_TEXTURE0 + i);
+				if (bound_textures[i].texture != 0 && bound_textures[i].target != pipeline.textures[i].target) {
+					//unbind texture of a different target so units don't accumulate bindings:
+					glBindTexture(bound_textures[i].target, 0);
+					draw_stats.state_changes += 1;
+					texture_unbinds += 1;
+				}
 				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+				bound_textures[i] = pipeline.textures[i];
+				draw_stats.state_changes += 1;
+			} else {
+				draw_stats.state_changes_saved += 1;
 			}
 		}
+	};
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+	//binds program and vertex array, if they aren't already bound:
+	auto bind_program_and_vao = [&](GLuint program, GLuint vao) {
+		if (program != bound_program) {
+			glUseProgram(program);
+			bound_program = program;
+			draw_stats.state_changes += 1;
+		} else {
+			draw_stats.state_changes_saved += 1;
+		}
+		if (vao != bound_vao) {
+			glBindVertexArray(vao);
+			bound_vao = vao;
+			draw_stats.state_changes += 1;
+		} else {
+			draw_stats.state_changes_saved += 1;
+		}
+	};
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+	//Face culling is only touched if some drawable has Pipeline::cull_back_faces; other drawables are drawn with
+	// the caller's face-culling state, which is queried once here and restored after the last draw:
+	struct FaceCulling {
+		GLboolean enabled = GL_FALSE;
+		GLint front_face = GL_CCW;
+		GLint cull_face = GL_BACK;
+	};
+	bool any_culling = std::any_of(render_queue.begin(), render_queue.end(), [](RenderItem const &item) {
+		return item.drawable->pipeline.cull_back_faces;
+	});
+	FaceCulling caller_culling;
+	if (any_culling) {
+		caller_culling.enabled = glIsEnabled(GL_CULL_FACE);
+		glGetIntegerv(GL_FRONT_FACE, &caller_culling.front_face);
+		glGetIntegerv(GL_CULL_FACE_MODE, &caller_culling.cull_face);
+	}
+	FaceCulling bound_culling = caller_culling;
+	auto set_culling = [&](FaceCulling const &culling) {
+		if (culling.enabled != bound_culling.enabled) {
+			if (culling.enabled) glEnable(GL_CULL_FACE);
+			else glDisable(GL_CULL_FACE);
+		}
+		if (culling.front_face != bound_culling.front_face) glFrontFace(culling.front_face);
+		if (culling.cull_face != bound_culling.cull_face) glCullFace(culling.cull_face);
+		bound_culling = culling;
+	};
+	//culls back faces of the given front face winding (or draws both sides, for GL_NONE) if the pipeline asks for it:
+	auto set_front_face = [&](Pipeline const &pipeline, GLenum front_face) {
+		if (!any_culling) return;
+		FaceCulling culling = caller_culling;
+		if (pipeline.cull_back_faces) {
+			culling.enabled = (front_face != GL_NONE);
+			if (front_face != GL_NONE) {
+				culling.front_face = front_face;
+				culling.cull_face = GL_BACK;
+			}
+		}
+		set_culling(culling);
+	};
+
+	//Send each drawable (or run of instanced drawables) to OpenGL:
+	for (size_t q = 0; q < render_queue.size(); ++q) {
+		RenderItem const &item = render_queue[q];
+		Drawable const &drawable = *item.drawable;
+		//Reference to drawable's pipeline for convenience:
+		Pipeline const &pipeline = drawable.pipeline;
+		//..and the vertex range to draw with it:
+		DrawRange range = draw_range(item);
+
+		if (item.instance_count) {
+			bind_program_and_vao(pipeline.instanced_program, pipeline.instanced_vao);
+			set_front_face(pipeline, item.front_face);
+
+			//point the per-instance attribute at this run's matrices (one vec3 column per location):
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			for (GLuint c = 0; c < 4; ++c) {
+				GLuint location = pipeline.INSTANCE_TO_WORLD_mat4x3 + c;
+				glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLbyte *)0 + item.instance_first * sizeof(InstanceData) + offsetof(InstanceData, object_to_world) + c * sizeof(glm::vec3));
+				glEnableVertexAttribArray(location);
+				glVertexAttribDivisor(location, 1);
+			}
+			if (pipeline.INSTANCE_LIGHTS_ivec4 != -1U) {
+				glVertexAttribIPointer(pipeline.INSTANCE_LIGHTS_ivec4, 4, GL_INT, sizeof(InstanceData), (GLbyte *)0 + item.instance_first * sizeof(InstanceData) + offsetof(InstanceData, lights));
+				glEnableVertexAttribArray(pipeline.INSTANCE_LIGHTS_ivec4);
+				glVertexAttribDivisor(pipeline.INSTANCE_LIGHTS_ivec4, 1);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			if (pipeline.WORLD_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(pipeline.WORLD_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
 			}
+			if (pipeline.WORLD_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.WORLD_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(world_to_light));
+			}
+			if (pipeline.DEQUANTIZE_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.DEQUANTIZE_mat4x3, 1, GL_FALSE, glm::value_ptr(*range.dequantize));
+			}
+
+			bind_textures(pipeline);
+
+			if (pipeline.index_type != GL_NONE) {
+				glDrawElementsInstancedBaseVertex(pipeline.type, range.count, pipeline.index_type, index_offset(pipeline, range), item.instance_count, range.start);
+			} else {
+				glDrawArraysInstanced(pipeline.type, range.start, range.count, item.instance_count);
+			}
+			draw_stats.draws += 1;
+			draw_stats.instanced_draws += 1;
+			draw_stats.instances += item.instance_count;
+
+			//skip the rest of the run:
+			q += item.instance_count - 1;
+			continue;
 		}
-		glActiveTexture(GL_TEXTURE0);
 
+		//every meshlet was culled? nothing to draw:
+		if (item.multi_count == 0) continue;
+
+		bind_program_and_vao(pipeline.program, pipeline.vao);
+		set_front_face(pipeline, item.front_face);
+
+		//Configure program uniforms:
+
+		if (item.object_block != -1U) {
+			//matrices were already uploaded; just point the OBJECT block at this drawable's copy:
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, object_block_buffer, item.object_block * object_block_stride, sizeof(ObjectBlock));
+		} else {
+			//the object-to-world matrix is used in all three of these uniforms:
+			glm::mat4x3 const &object_to_world = item.object_to_world;
+
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world) * glm::mat4(*range.dequantize);
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			}
+
+			//the object-to-light matrix is used in the next two uniforms:
+			glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glm::mat4x3 position_to_light = object_to_light * glm::mat4(*range.dequantize);
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(position_to_light));
+			}
+
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			}
+		}
+
+		//set any requested custom uniforms:
+		if (pipeline.set_uniforms) pipeline.set_uniforms();
+
+		//set up textures:
+		bind_textures(pipeline);
+
+		//draw the object:
+		if (item.multi_count != -1U) {
+			//..just its visible meshlets:
+			if (item.multi_count == 1) {
+				glDrawElementsBaseVertex(pipeline.type, multi_draw.counts[item.multi_first], pipeline.index_type, multi_draw.offsets[item.multi_first], multi_draw.base_vertices[item.multi_first]);
+			} else {
+				glMultiDrawElementsBaseVertex(pipeline.type, &multi_draw.counts[item.multi_first], pipeline.index_type, &multi_draw.offsets[item.multi_first], GLsizei(item.multi_count), &multi_draw.base_vertices[item.multi_first]);
+			}
+		} else if (pipeline.index_type != GL_NONE) {
+			glDrawElementsBaseVertex(pipeline.type, range.count, pipeline.index_type, index_offset(pipeline, range), range.start);
+		} else {
+			glDrawArrays(pipeline.type, range.start, range.count);
+		}
+		draw_stats.draws += 1;
 	}
 
+	//un-bind textures:
+	for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+		if (bound_textures[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(bound_textures[i].target, 0);
+			draw_stats.state_changes += 1;
+			texture_unbinds += 1;
+		}
+	}
+	assert(texture_unbinds <= per_draw_unbinds); //(every un-bind follows a draw that bound that unit)
+	draw_stats.texture_unbinds_saved = per_draw_unbinds - texture_unbinds;
+	glActiveTexture(GL_TEXTURE0);
+	if (light_clusters) light_clusters->unbind();
+
+	if (any_culling) set_culling(caller_culling);
+
 	glUseProgram(0);
 	glBindVertexArray(0);
 
 	GL_ERRORS();
 }
 
+//-------------------------
+//batched local-to-parent matrices:
+
+namespace {
+	//"lane" types that let one kernel work on 1 or 4 (SSE) transforms at once:
+	// (SSE only: it is part of every x86-64 target, so it needs no compiler flags or runtime checks)
+	struct ScalarLanes {
+		enum : size_t { Width = 1 };
+		typedef float V;
+		static V load(float const *p) { return *p; }
+		static void store(float *p, V v) { *p = v; }
+		static V set1(float f) { return f; }
+		static V add(V a, V b) { return a + b; }
+		static V sub(V a, V b) { return a - b; }
+		static V mul(V a, V b) { return a * b; }
+	};
+#ifdef SCENE_USE_SSE
+	struct SSELanes {
+		enum : size_t { Width = 4 };
+		typedef __m128 V;
+		static V load(float const *p) { return _mm_loadu_ps(p); }
+		static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+		static V set1(float f) { return _mm_set1_ps(f); }
+		static V add(V a, V b) { return _mm_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+	};
+#endif
+	//Same math as Transform::make_local_to_parent() (with glm::mat3_cast expanded), for transforms [begin,end):
+	// returns the index of the first transform not processed (i.e., the start of any partial batch)
+	template< typename L >
+	size_t make_local_to_parent_lanes(Scene::TransformArray::Locals &locals, size_t begin, size_t end) {
+		typedef typename L::V V;
+		V one = L::set1(1.0f);
+		V two = L::set1(2.0f);
+		size_t i = begin;
+		for (; i + L::Width <= end; i += L::Width) {
+			V qx = L::load(&locals.rotation[0][i]);
+			V qy = L::load(&locals.rotation[1][i]);
+			V qz = L::load(&locals.rotation[2][i]);
+			V qw = L::load(&locals.rotation[3][i]);
+
+			V xx = L::mul(qx, qx), yy = L::mul(qy, qy), zz = L::mul(qz, qz);
+			V xy = L::mul(qx, qy), xz = L::mul(qx, qz), yz = L::mul(qy, qz);
+			V wx = L::mul(qw, qx), wy = L::mul(qw, qy), wz = L::mul(qw, qz);
+
+			V sx = L::load(&locals.scale[0][i]);
+			V sy = L::load(&locals.scale[1][i]);
+			V sz = L::load(&locals.scale[2][i]);
+
+			//rotation columns, scaled by the matching scale component:
+			L::store(&locals.local_to_parent[0][i], L::mul(sx, L::sub(one, L::mul(two, L::add(yy, zz)))));
+			L::store(&locals.local_to_parent[1][i], L::mul(sx, L::mul(two, L::add(xy, wz))));
+			L::store(&locals.local_to_parent[2][i], L::mul(sx, L::mul(two, L::sub(xz, wy))));
+
+			L::store(&locals.local_to_parent[3][i], L::mul(sy, L::mul(two, L::sub(xy, wz))));
+			L::store(&locals.local_to_parent[4][i], L::mul(sy, L::sub(one, L::mul(two, L::add(xx, zz)))));
+			L::store(&locals.local_to_parent[5][i], L::mul(sy, L::mul(two, L::add(yz, wx))));
+
+			L::store(&locals.local_to_parent[6][i], L::mul(sz, L::mul(two, L::add(xz, wy))));
+			L::store(&locals.local_to_parent[7][i], L::mul(sz, L::mul(two, L::sub(yz, wx))));
+			L::store(&locals.local_to_parent[8][i], L::mul(sz, L::sub(one, L::mul(two, L::add(xx, yy)))));
+
+			//translation column:
+			L::store(&locals.local_to_parent[9][i], L::load(&locals.position[0][i]));
+			L::store(&locals.local_to_parent[10][i], L::load(&locals.position[1][i]));
+			L::store(&locals.local_to_parent[11][i], L::load(&locals.position[2][i]));
+		}
+		return i;
+	}
+
+	void make_local_to_parent_batch(Scene::TransformArray::Locals &locals, size_t begin, size_t end) {
+		size_t i = begin;
+		#ifdef SCENE_USE_SSE
+		i = make_local_to_parent_lanes< SSELanes >(locals, i, end);
+		#endif
+		i = make_local_to_parent_lanes< ScalarLanes >(locals, i, end);
+		assert(i == end);
+	}
+}
+
+void Scene::update_world_matrices() {
+	transforms.update_parent_indices();
+
+	//large scenes are split across worker threads (as long as the hierarchy can be split into depth levels):
+	bool parallel = (transforms.size() >= ParallelUpdateThreshold && transforms.update_depth_levels());
+	WorkerPool *pool = (parallel ? &WorkerPool::shared() : nullptr);
+	//helper that runs fn over [0,count) on the pool (if parallel) or directly:
+	auto for_range = [&](size_t count, std::function< void(size_t, size_t) > const &fn) {
+		if (pool) pool->parallel_for(count, 1024, fn);
+		else if (count) fn(0, count);
+	};
+
+	//gather local transforms into separate position/rotation/scale arrays:
+	auto &locals = transforms.locals;
+	size_t padded = (transforms.size() + 7) / 8 * 8;
+	for (auto &a : locals.position) a.resize(padded, 0.0f);
+	for (auto &a : locals.rotation) a.resize(padded, 0.0f);
+	for (auto &a : locals.scale) a.resize(padded, 0.0f);
+	for (auto &a : locals.local_to_parent) a.resize(padded, 0.0f);
+
+	for_range(transforms.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			Transform const &transform = transforms[i];
+			locals.position[0][i] = transform.position.x;
+			locals.position[1][i] = transform.position.y;
+			locals.position[2][i] = transform.position.z;
+			locals.rotation[0][i] = transform.rotation.x;
+			locals.rotation[1][i] = transform.rotation.y;
+			locals.rotation[2][i] = transform.rotation.z;
+			locals.rotation[3][i] = transform.rotation.w;
+			locals.scale[0][i] = transform.scale.x;
+			locals.scale[1][i] = transform.scale.y;
+			locals.scale[2][i] = transform.scale.z;
+		}
+	});
+
+	//build all local-to-parent matrices with SIMD kernels:
+	for_range(padded / 8, [&](size_t begin, size_t end) {
+		make_local_to_parent_batch(locals, begin * 8, end * 8);
+	});
+
+	//rebuild transform i's world matrix if dirty, assuming its parent is already up to date:
+	auto update_world = [&](uint32_t i) {
+		Transform const &transform = transforms[i];
+		if (!transform.world_cache_dirty()) return;
+
+		glm::mat4x3 local_to_parent;
+		for (uint32_t e = 0; e < 12; ++e) {
+			local_to_parent[e / 3][e % 3] = locals.local_to_parent[e][i];
+		}
+		if (!transform.parent) {
+			transform.store_world_cache(local_to_parent);
+		} else {
+			transform.store_world_cache(transform.parent->world_cache.local_to_world * glm::mat4(local_to_parent));
+		}
+	};
+
+	if (parallel) {
+		//every transform in a level only reads world matrices from earlier levels, so each level can be split freely:
+		for (uint32_t d = 0; d + 1 < transforms.level_begin.size(); ++d) {
+			uint32_t level_start = transforms.level_begin[d];
+			pool->parallel_for(transforms.level_begin[d+1] - level_start, 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					update_world(transforms.level_order[level_start + i]);
+				}
+			});
+		}
+	} else {
+		//walk the hierarchy in order, rebuilding only the world matrices that are dirty:
+		for (uint32_t i = 0; i < transforms.size(); ++i) {
+			Transform const &transform = transforms[i];
+			uint32_t parent_index = transforms.parent_indices[i];
+			//transforms are (almost always) stored parent-before-child, so the parent is already up to date:
+			if (transform.parent && !(parent_index < i)) {
+				//...but handle parents stored later in the array or in another scene:
+				transform.parent->update_world_cache();
+			}
+			update_world(i);
+		}
+	}
+}
 
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	//chunks are read in place from the mapped file (no intermediate copies):
+	MappedFile file(filename);
+	ChunkReader reader(file.data(), file.data() + file.size());
+	note_load_read(file.size());
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkView< char > names = reader.read_chunk< char >("str0");
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +1128,7 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	ChunkView< HierarchyEntry > hierarchy = reader.read_chunk< HierarchyEntry >("xfh0");
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +1136,7 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	ChunkView< MeshEntry > meshes = reader.read_chunk< MeshEntry >("msh0");
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +1145,7 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > cameras;
-	read_chunk(file, "cam0", &cameras);
+	ChunkView< CameraEntry > cameras = reader.read_chunk< CameraEntry >("cam0");
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,8 +1156,7 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > lights;
-	read_chunk(file, "lmp0", &lights);
+	ChunkView< LightEntry > lights = reader.read_chunk< LightEntry >("lmp0");
 
 
 	//--------------------------------
@@ -225,8 +1166,7 @@ void Scene::load(std::string const &filename,
 	hierarchy_transforms.reserve(hierarchy.size());
 
 	for (auto const &h : hierarchy) {
-		transforms.emplace_back();
-		Transform *t = &transforms.back();
+		Transform *t = &transforms.emplace_back();
 		if (h.parent != -1U) {
 			if (h.parent >= hierarchy_transforms.size()) {
 				throw std::runtime_error("scene file '" + filename + "' did not contain transforms in topological-sort order.");
@@ -299,12 +1239,16 @@ void Scene::load(std::string const &filename,
 		light->type = static_cast<Light::Type>(l.type);
 		light->energy = glm::vec3(l.color) / 255.0f * l.energy;
 		light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
+		light->distance = l.distance;
 	}
 
 	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	// (through a stream over the rest of the mapping)
+	MemoryStreambuf rest_buf(reader.at, reader.end);
+	std::istream rest(&rest_buf);
+	load_extra(rest, std::vector< char >(names.begin(), names.end()), hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (rest.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -11,10 +11,12 @@
  */
 
 #include "GL.hpp"
+#include "Meshlet.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <limits>
 #include <list>
 #include <memory>
 #include <functional>
@@ -22,6 +24,8 @@
 #include <vector>
 #include <unordered_map>
 
+struct LightClusters;
+
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
@@ -40,9 +44,39 @@ struct Scene {
 		glm::mat4x3 make_local_to_parent() const;
 		glm::mat4x3 make_parent_to_local() const;
 		// ..relative to the world:
+		// (these are cached, so repeated calls only rebuild matrices for transforms that changed)
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
+		//World matrices are computed lazily and cached along with the local state they were built from.
+		// The cache is dirty whenever position/rotation/scale/parent differ from that snapshot or the parent's
+		// world matrix has changed since (tracked via 'version'), so modifying fields directly is fine.
+		// (n.b. the cache is 'mutable' so const transforms can fill it; this is not thread-safe)
+		struct WorldCache {
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(1.0f);
+			Transform const *parent = nullptr;
+			uint32_t parent_version = 0; //parent's version when local_to_world was computed
+			uint32_t version = 0; //bumped every time local_to_world is rebuilt; 0 means "never built"
+			bool has_world_to_local = false; //world_to_local is built on demand from local_to_world's state
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+		};
+		mutable WorldCache world_cache;
+
+		//rebuild world_cache.local_to_world (and this transform's ancestors' caches) if dirty:
+		void update_world_cache() const;
+		//..same, but assumes the parent's cache is already up to date (used by Scene::update_world_matrices):
+		void refresh_world_cache() const;
+		//does world_cache need to be rebuilt? (assumes the parent's cache is already up to date):
+		bool world_cache_dirty() const;
+		//record a freshly computed local-to-world matrix (and the state it was computed from) in world_cache:
+		void store_world_cache(glm::mat4x3 const &local_to_world) const;
+
+		//slot in the owning Scene's 'transforms' array (-1U if not stored in one):
+		uint32_t array_index = -1U;
+
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
@@ -54,6 +88,13 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//Bounding box of the drawn vertices in the transform's local space, used for view-frustum culling:
+		// (the default, min > max, means "unknown" and the drawable is never culled)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//world-space box around [min,max] (given the transform's local-to-world matrix):
+		void make_world_box(glm::mat4x3 const &local_to_world, glm::vec3 *world_min, glm::vec3 *world_max) const;
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -62,16 +103,66 @@ struct Scene {
 			GLuint vao = 0; //attrib->buffer mapping; passed to glBindVertexArray
 
 			GLenum type = GL_TRIANGLES; //what sort of primitive to draw; passed to glDrawArrays
-			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
-			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
+			GLuint start = 0; //first vertex to draw; passed to glDrawArrays (or base vertex, for indexed drawing)
+			GLuint count = 0; //number of vertices (or element indices) to draw; passed to glDrawArrays
+
+			//indexed drawing (optional; the vao must have an element buffer bound -- see Mesh::index_type):
+			GLenum index_type = GL_NONE; //if not GL_NONE, draw with glDrawElementsBaseVertex using indices of this type
+			GLuint index_start = 0; //first element index to draw
+
+			//quantized positions (see Mesh::dequantize): applied to positions before the object-to-world transform
+			glm::mat4x3 dequantize = glm::mat4x3(1.0f);
+
+			//levels of detail (optional; see Mesh::lods):
+			// draw() uses the coarsest level whose max_size is above the projected height of the sphere around
+			// Drawable::min/max (as a fraction of the viewport height) instead of the range above; unused levels have count == 0
+			enum : uint32_t { MaxLODs = 4 };
+			struct LOD {
+				GLuint start = 0;
+				GLuint count = 0;
+				GLuint index_start = 0;
+				glm::mat4x3 dequantize = glm::mat4x3(1.0f);
+				float max_size = 0.0f;
+			} lods[MaxLODs];
+
+			//meshlets (optional; indexed GL_TRIANGLES only -- see Meshlet.hpp and Mesh::meshlets):
+			// when drawing the range above (not a level of detail, nor instanced), draw() skips meshlets that can't be seen
+			// (the meshlets must outlive the pipeline -- typically they belong to a MeshBuffer held by a Load<>)
+			Meshlet const *meshlets = nullptr;
+			uint32_t meshlet_count = 0;
+
+			//back-face culling (only for closed meshes, since the inside of an open mesh would vanish):
+			// draw() culls back faces with GL_CULL_FACE (flipping the front face for mirrored transforms),
+			// and also skips meshlets whose triangles all face away from the camera
+			// (other pipelines are drawn with the caller's face-culling state, which draw() leaves as it found it)
+			bool cull_back_faces = false;
 
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
+			//uniform blocks:
+			GLuint OBJECT_block = -1U; //index of the per-object "OBJECT" uniform block (see Scene::ObjectBlock), used instead of the OBJECT_TO_* / NORMAL_TO_* uniforms if present
+
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
+			//draw order:
+			// draw() sorts drawables by state (program, vertex array, textures, ...), but never moves them past a drawable
+			// with keep_order set; those are drawn exactly where they are in the list (use for blended, transparent, or decal drawables).
+			bool keep_order = false;
+
+			//instancing (optional):
+			// drawables with the same pipeline and vertex range (and no set_uniforms) are drawn together with instanced_program,
+			// which reads each drawable's object-to-world matrix from a per-instance attribute instead of the OBJECT_TO_* uniforms.
+			GLuint instanced_program = 0; //shader program used for instanced draws (0 => never instance this drawable)
+			GLuint instanced_vao = 0; //attrib->buffer mapping for instanced_program (per-instance attributes are bound by Scene::draw)
+			GLuint INSTANCE_TO_WORLD_mat4x3 = -1U; //attribute location for object to world matrix (uses four consecutive locations)
+			GLuint INSTANCE_LIGHTS_ivec4 = -1U; //(optional) attribute location for the instance's light indices (see ObjectBlock::OBJECT_LIGHTS)
+			GLuint WORLD_TO_CLIP_mat4 = -1U; //uniform location (in instanced_program) for world to clip space matrix
+			GLuint WORLD_TO_LIGHT_mat4x3 = -1U; //uniform location (in instanced_program) for world to light space matrix
+			GLuint DEQUANTIZE_mat4x3 = -1U; //uniform location (in instanced_program) for 'dequantize'
+
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
 			struct TextureInfo {
@@ -114,20 +205,230 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//Point and spot lights don't light anything further away than this (0 => no limit):
+		// (their light fades out smoothly to nothing at this distance)
+		float distance = 0.0f;
+	};
+
+	//Transforms are stored in fixed-size blocks of contiguous memory:
+	// - pointers to transforms stay valid as more are added (blocks never move)
+	// - iteration order is creation order, which Scene::load keeps parent-before-child
+	// (interface is a std::list-like subset, so code that walks or appends transforms doesn't change)
+	struct TransformArray {
+		enum : uint32_t { BlockSize = 256 }; //transforms per block (power of two)
+
+		TransformArray() = default;
+		TransformArray(TransformArray const &) = delete;
+		TransformArray &operator=(TransformArray const &) = delete;
+		~TransformArray() { clear(); }
+
+		//add a default-constructed transform at the end:
+		Transform &emplace_back();
+		//destroy all transforms (invalidates pointers):
+		void clear();
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		Transform &operator[](size_t i) { assert(i < count); return blocks[i / BlockSize][i % BlockSize]; }
+		Transform const &operator[](size_t i) const { assert(i < count); return blocks[i / BlockSize][i % BlockSize]; }
+		Transform &front() { return (*this)[0]; }
+		Transform const &front() const { return (*this)[0]; }
+		Transform &back() { return (*this)[count-1]; }
+		Transform const &back() const { return (*this)[count-1]; }
+
+		//index of a transform in this array, or -1U if it is stored somewhere else (or is null):
+		uint32_t index_of(Transform const *transform) const {
+			if (!transform || transform->array_index >= count) return -1U;
+			return (&(*this)[transform->array_index] == transform ? transform->array_index : -1U);
+		}
+
+		template< typename A, typename T >
+		struct Iterator {
+			A *array;
+			size_t index;
+			T &operator*() const { return (*array)[index]; }
+			T *operator->() const { return &(*array)[index]; }
+			Iterator &operator++() { ++index; return *this; }
+			bool operator==(Iterator const &other) const { return index == other.index; }
+			bool operator!=(Iterator const &other) const { return index != other.index; }
+		};
+		typedef Iterator< TransformArray, Transform > iterator;
+		typedef Iterator< TransformArray const, Transform const > const_iterator;
+		iterator begin() { return iterator{this, 0}; }
+		iterator end() { return iterator{this, count}; }
+		const_iterator begin() const { return const_iterator{this, 0}; }
+		const_iterator end() const { return const_iterator{this, count}; }
+
+		//flattened hierarchy, rebuilt by update_parent_indices():
+		// parent_indices[i] is the index of transform i's parent, or -1U if it has no parent (or its parent lives elsewhere)
+		std::vector< uint32_t > parent_indices;
+		void update_parent_indices();
+
+		//hierarchy depth levels, rebuilt by update_depth_levels():
+		// level_order lists transform indices sorted by depth; level 'd' is level_order[level_begin[d]..level_begin[d+1])
+		// returns false (and leaves levels empty) if some transform's parent is not stored before it in this array
+		std::vector< uint32_t > level_order;
+		std::vector< uint32_t > level_begin;
+		bool update_depth_levels(); //(call after update_parent_indices)
+
+		//structure-of-arrays copy of local transforms used by Scene::update_world_matrices:
+		// (arrays are padded to a multiple of 8 so work can be split into whole SIMD batches)
+		struct Locals {
+			std::vector< float > position[3]; //x,y,z
+			std::vector< float > rotation[4]; //x,y,z,w
+			std::vector< float > scale[3]; //x,y,z
+			std::vector< float > local_to_parent[12]; //column-major mat4x3 elements
+		} locals;
+
+		//-- internals --
+		std::vector< Transform * > blocks; //each block is raw storage for BlockSize transforms
+		size_t count = 0;
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
+	TransformArray transforms;
 	std::list< Drawable > drawables;
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Uniform blocks that draw() fills for programs that declare them:
+	// programs should bind these block names to these binding points with glUniformBlockBinding()
+	enum : GLuint {
+		FrameBlockBinding = 0, //"FRAME" block -- camera and lighting, uploaded once per draw()
+		ObjectBlockBinding = 1, //"OBJECT" block -- per-drawable matrices; every drawable's block is uploaded together and selected with glBindBufferRange()
+	};
+
+	//Lights are sent to programs as one array in the FRAME block;
+	// each drawable then gets (up to) MaxObjectLights indices into that array -- the lights that matter most for it --
+	// so the per-fragment light loop has bounded cost however many lights the scene has:
+	// (if the scene has no lights, draw() uses a single white hemisphere light shining down -z)
+	enum : uint32_t {
+		MaxLights = 32, //lights past this many are ignored
+		MaxObjectLights = 4,
+	};
+
+	//std140 layout of one light in the FRAME block (in light space):
+	struct LightInfo {
+		glm::vec3 LOCATION; //(point and spot lights)
+		int32_t TYPE; //0: point, 1: hemisphere, 2: spot, 3: directional
+		glm::vec3 DIRECTION; //(hemisphere, spot, and directional lights)
+		float CUTOFF; //cosine of spot light half-angle
+		glm::vec3 ENERGY;
+		float RADIUS; //(point and spot lights) shaders fade the light to nothing at this distance; 0 => no limit
+	};
+	static_assert(sizeof(LightInfo) == 3 * 16, "LightInfo matches std140 layout.");
+
+	//std140 layout of the FRAME block:
+	struct FrameBlock {
+		glm::mat4 WORLD_TO_CLIP;
+		glm::mat4 WORLD_TO_LIGHT; //(mat4x3 padded to mat4)
+		int32_t LIGHT_COUNT;
+		int32_t _pad0[3];
+		LightInfo LIGHTS[MaxLights];
+		//clustered lighting (see LightClusters.hpp), used instead of LIGHTS when CLUSTER_GRID.x != 0:
+		glm::ivec4 CLUSTER_GRID; //tiles in x, tiles in y, depth slices, global (unbinned) light count
+		glm::vec4 CLUSTER_SCALE; //tiles per pixel in x and y, camera near plane, depth slices per unit of log(depth / near)
+	};
+	static_assert(sizeof(FrameBlock) == 64 + 64 + 16 + MaxLights * sizeof(LightInfo) + 16 + 16, "FrameBlock matches std140 layout.");
+
+	//std140 layout of the OBJECT block:
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::mat4 OBJECT_TO_LIGHT; //(mat4x3 padded to mat4)
+		glm::vec4 NORMAL_TO_LIGHT[3]; //(mat3 with columns padded to vec4)
+		glm::ivec4 OBJECT_LIGHTS; //indices into FrameBlock::LIGHTS, strongest first; unused entries are -1
+	};
+	static_assert(sizeof(ObjectBlock) == 64 + 64 + 3*16 + 16, "ObjectBlock matches std140 layout.");
+	static_assert(MaxObjectLights == 4, "ObjectBlock::OBJECT_LIGHTS holds MaxObjectLights indices.");
+
+	//(optional) lights binned by LightClusters::update for this frame's camera;
+	// if set, draw() binds its buffer textures and lit shaders read lights per-cluster instead of per-drawable:
+	LightClusters const *light_clusters = nullptr;
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//..or draw just some of the drawables (e.g., from SceneBVH::frustum_query; these are not culled again, and should be in list order):
+	void draw(std::vector< Drawable const * > const &visible, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+
+	//draw() culls drawables against the view frustum (using Drawable::min/max),
+	// sorts them by pipeline state (program, vao, textures, type), and skips redundant binds;
+	// these counters describe the most recent draw() call:
+	struct DrawStats {
+		uint32_t drawn = 0; //drawables that passed view-frustum culling
+		uint32_t culled = 0; //drawables whose bounding box was entirely outside the view frustum
+		uint32_t draws = 0; //draw calls issued
+		uint32_t instanced_draws = 0; //..of which were instanced
+		uint32_t instances = 0; //drawables drawn by instanced draw calls
+		uint32_t state_changes = 0; //program, vertex array, and texture binds (and texture un-binds) actually issued
+		uint32_t state_changes_saved = 0; //program, vertex array, and texture binds skipped because they were already bound
+		uint32_t texture_unbinds_saved = 0; //texture un-binds skipped, compared to un-binding every texture after each draw
+		uint32_t lod_reduced = 0; //drawables drawn with one of their lower levels of detail
+		uint32_t meshlets_drawn = 0; //meshlets that passed culling
+		uint32_t meshlets_culled = 0; //meshlets outside the view frustum or facing away from the camera
+	};
+	mutable DrawStats draw_stats;
+
+	//projected sizes are multiplied by this before choosing levels of detail:
+	// (lower it to switch to coarser levels sooner, e.g., to keep a large scene within a vertex budget)
+	float lod_scale = 1.0f;
+
+	//drawables to submit this frame, in sorted order (kept around to avoid reallocating every frame):
+	struct RenderItem {
+		Drawable const *drawable;
+		uint32_t order; //position in 'drawables', so equal pipelines still draw in list order
+		glm::mat4x3 object_to_world; //the drawable's transform's local-to-world matrix (looked up once, when queued)
+		uint32_t instance_count = 0; //if non-zero, this item starts an instanced draw of this many items
+		uint32_t instance_first = 0; //..whose matrices start at this index in instance_data
+		uint32_t object_block = -1U; //index into object_blocks, if the pipeline uses an OBJECT block
+		uint32_t lod = 0; //level of detail to draw (0 => the pipeline's own range, n => pipeline.lods[n-1])
+		uint32_t multi_first = 0; //(meshlet culling) first visible range in multi_draw
+		uint32_t multi_count = -1U; //..and number of ranges (-1U => not culled by meshlet; draw the whole range)
+		GLenum front_face = GL_NONE; //front face winding (GL_CCW, or GL_CW if mirrored) to cull back faces with, or GL_NONE to draw both sides
+	};
+	mutable std::vector< RenderItem > render_queue;
+	mutable std::vector< char > object_blocks; //ObjectBlock's for this draw(), each padded to the uniform buffer offset alignment
+	struct InstanceData {
+		glm::mat4x3 object_to_world; //read through INSTANCE_TO_WORLD
+		glm::ivec4 lights; //read through INSTANCE_LIGHTS
+	};
+	static_assert(sizeof(InstanceData) == 4*3*4 + 4*4, "InstanceData is packed.");
+	mutable std::vector< InstanceData > instance_data; //per-instance data, uploaded once per draw()
+
+	//ranges of visible meshlets for this draw(), in glMultiDrawElementsBaseVertex's format:
+	struct MultiDraw {
+		std::vector< GLsizei > counts;
+		std::vector< GLvoid const * > offsets;
+		std::vector< GLint > base_vertices;
+	};
+	mutable MultiDraw multi_draw;
+
+	//lights in this draw()'s FRAME block, with what select_lights() needs to rank them:
+	struct ActiveLight {
+		Light::Type type;
+		glm::vec3 position; //world space
+		float distance; //(0 => no limit)
+		float strength; //brightest energy component
+	};
+	mutable std::vector< ActiveLight > active_lights;
+	//indices of the (up to) MaxObjectLights active_lights that contribute most to a drawable:
+	glm::ivec4 select_lights(Drawable const &drawable, glm::mat4x3 const &object_to_world) const;
+	enum : uint32_t { MinInstances = 2 }; //smallest run of matching drawables worth an instanced draw
+	//sort render_queue, then send it to OpenGL (shared by the draw() functions):
+	void draw_render_queue(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const;
+
+	//bring every transform's cached world matrix up to date in a single pass over 'transforms':
+	// (optional -- make_local_to_world() updates caches lazily -- but faster when many transforms move each frame)
+	// local matrices are built in batches of 4 transforms (with SSE, where available); world matrices are only rebuilt when dirty.
+	// scenes with at least ParallelUpdateThreshold transforms are updated one depth level at a time on WorkerPool::shared()
+	enum : uint32_t { ParallelUpdateThreshold = 4096 };
+	void update_world_matrices();
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -0,0 +1,268 @@
+#include "SceneBVH.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+void SceneBVH::build(Scene const &scene) {
+	drawables.clear();
+	unbounded.clear();
+	drawable_rank.clear();
+	unbounded_rank.clear();
+	uint32_t rank = 0;
+	for (auto const &drawable : scene.drawables) {
+		if (drawable.min.x <= drawable.max.x) {
+			drawables.emplace_back(&drawable);
+			drawable_rank.emplace_back(rank);
+		} else {
+			unbounded.emplace_back(&drawable);
+			unbounded_rank.emplace_back(rank);
+		}
+		rank += 1;
+	}
+	drawable_min.assign(drawables.size(), glm::vec3(0.0f));
+	drawable_max.assign(drawables.size(), glm::vec3(0.0f));
+
+	order.resize(drawables.size());
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	nodes.clear();
+	if (drawables.empty()) return;
+
+	//boxes are needed to decide splits:
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		assert(drawables[i]->transform); //drawables *must* have a transform
+		drawables[i]->make_world_box(drawables[i]->transform->make_local_to_world(), &drawable_min[i], &drawable_max[i]);
+	}
+
+	//recursively split [begin,end) of 'order' at the median centroid along its widest axis:
+	std::function< uint32_t(uint32_t, uint32_t) > build_node = [&](uint32_t begin, uint32_t end) -> uint32_t {
+		uint32_t index = uint32_t(nodes.size());
+		nodes.emplace_back();
+
+		if (end - begin <= LeafSize) {
+			nodes[index].first = begin;
+			nodes[index].count = end - begin;
+			return index;
+		}
+
+		glm::vec3 centroid_min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 centroid_max = glm::vec3(-std::numeric_limits< float >::infinity());
+		for (uint32_t i = begin; i < end; ++i) {
+			glm::vec3 centroid = 0.5f * (drawable_min[order[i]] + drawable_max[order[i]]);
+			centroid_min = glm::min(centroid_min, centroid);
+			centroid_max = glm::max(centroid_max, centroid);
+		}
+		glm::vec3 size = centroid_max - centroid_min;
+		int axis = 0;
+		if (size.y > size[axis]) axis = 1;
+		if (size.z > size[axis]) axis = 2;
+
+		uint32_t mid = begin + (end - begin) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+			return drawable_min[a][axis] + drawable_max[a][axis] < drawable_min[b][axis] + drawable_max[b][axis];
+		});
+
+		uint32_t left = build_node(begin, mid);
+		uint32_t right = build_node(mid, end);
+		nodes[index].first = left;
+		nodes[index].right = right;
+		nodes[index].count = 0;
+		return index;
+	};
+	build_node(0, uint32_t(order.size()));
+
+	refit();
+}
+
+void SceneBVH::refit() {
+	for (uint32_t i = 0; i < drawables.size(); ++i) {
+		drawables[i]->make_world_box(drawables[i]->transform->make_local_to_world(), &drawable_min[i], &drawable_max[i]);
+	}
+
+	//children come after parents, so walking backward updates children first:
+	for (uint32_t n = uint32_t(nodes.size()); n > 0; --n) {
+		Node &node = nodes[n-1];
+		if (node.count) {
+			node.min = glm::vec3( std::numeric_limits< float >::infinity());
+			node.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				node.min = glm::min(node.min, drawable_min[order[i]]);
+				node.max = glm::max(node.max, drawable_max[order[i]]);
+			}
+		} else {
+			node.min = glm::min(nodes[node.first].min, nodes[node.right].min);
+			node.max = glm::max(nodes[node.first].max, nodes[node.right].max);
+		}
+	}
+}
+
+void SceneBVH::update(Scene const &scene) {
+	//same drawables (in the same order) as last build?
+	bool same = (drawables.size() + unbounded.size() == scene.drawables.size());
+	if (same) {
+		auto bounded_at = drawables.begin();
+		auto unbounded_at = unbounded.begin();
+		for (auto const &drawable : scene.drawables) {
+			bool has_bounds = (drawable.min.x <= drawable.max.x);
+			if (has_bounds && bounded_at != drawables.end() && *bounded_at == &drawable) ++bounded_at;
+			else if (!has_bounds && unbounded_at != unbounded.end() && *unbounded_at == &drawable) ++unbounded_at;
+			else { same = false; break; }
+		}
+	}
+
+	if (same) refit();
+	else build(scene);
+}
+
+void SceneBVH::frustum_query(glm::mat4 const &world_to_clip, std::vector< Scene::Drawable const * > *visible_) const {
+	assert(visible_);
+	auto &visible = *visible_;
+
+	//drawables found are collected as indices into 'drawables', then appended in list order (along with the unbounded ones):
+	std::vector< uint32_t > found;
+
+	//world-space clip planes (see outside_clip_volume in Scene.cpp):
+	glm::vec4 r0 = glm::vec4(world_to_clip[0][0], world_to_clip[1][0], world_to_clip[2][0], world_to_clip[3][0]);
+	glm::vec4 r1 = glm::vec4(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1], world_to_clip[3][1]);
+	glm::vec4 r2 = glm::vec4(world_to_clip[0][2], world_to_clip[1][2], world_to_clip[2][2], world_to_clip[3][2]);
+	glm::vec4 r3 = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+	glm::vec4 planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+
+	//classify a box: -1 => outside, 0 => intersecting, 1 => inside all planes
+	auto classify = [&planes](glm::vec3 const &min, glm::vec3 const &max) {
+		int ret = 1;
+		for (auto const &plane : planes) {
+			glm::vec3 n = glm::vec3(plane);
+			glm::vec3 far_corner = glm::vec3(n.x > 0.0f ? max.x : min.x, n.y > 0.0f ? max.y : min.y, n.z > 0.0f ? max.z : min.z);
+			glm::vec3 near_corner = glm::vec3(n.x > 0.0f ? min.x : max.x, n.y > 0.0f ? min.y : max.y, n.z > 0.0f ? min.z : max.z);
+			if (glm::dot(n, far_corner) + plane.w < 0.0f) return -1;
+			if (glm::dot(n, near_corner) + plane.w < 0.0f) ret = 0;
+		}
+		return ret;
+	};
+
+	//add every drawable under a node:
+	std::function< void(uint32_t) > add_all = [&](uint32_t n) {
+		Node const &node = nodes[n];
+		if (node.count) {
+			found.insert(found.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+		} else {
+			add_all(node.first);
+			add_all(node.right);
+		}
+	};
+
+	std::vector< uint32_t > stack;
+	if (!nodes.empty()) stack.emplace_back(0);
+	while (!stack.empty()) {
+		Node const &node = nodes[stack.back()];
+		uint32_t n = stack.back();
+		stack.pop_back();
+
+		int c = classify(node.min, node.max);
+		if (c < 0) continue;
+		if (c > 0) {
+			add_all(n);
+		} else if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (classify(drawable_min[order[i]], drawable_max[order[i]]) >= 0) {
+					found.emplace_back(order[i]);
+				}
+			}
+		} else {
+			stack.emplace_back(node.right);
+			stack.emplace_back(node.first);
+		}
+	}
+
+	//(so Scene::draw can keep list order where it matters; see Drawable::Pipeline::keep_order)
+	// 'drawables' is in list order, so put 'found' in index order -- by sorting if it's small, otherwise by marking:
+	if (found.size() * 16 < drawables.size()) {
+		std::sort(found.begin(), found.end());
+	} else {
+		std::vector< bool > marked(drawables.size(), false);
+		for (uint32_t d : found) marked[d] = true;
+		found.clear();
+		for (uint32_t d = 0; d < drawables.size(); ++d) {
+			if (marked[d]) found.emplace_back(d);
+		}
+	}
+	size_t u = 0;
+	for (uint32_t d : found) {
+		while (u < unbounded.size() && unbounded_rank[u] < drawable_rank[d]) visible.emplace_back(unbounded[u++]);
+		visible.emplace_back(drawables[d]);
+	}
+	while (u < unbounded.size()) visible.emplace_back(unbounded[u++]);
+}
+
+SceneBVH::Hit SceneBVH::ray_query(glm::vec3 const &origin, glm::vec3 const &direction,
+	std::function< bool(Scene::Drawable const &) > const &filter) const {
+	return ray_traverse(origin, direction, [&](uint32_t d, float t_box) {
+		if (filter && !filter(*drawables[d])) return std::numeric_limits< float >::infinity();
+		return t_box;
+	});
+}
+
+SceneBVH::Hit SceneBVH::ray_intersect(glm::vec3 const &origin, glm::vec3 const &direction,
+	std::function< float(Scene::Drawable const &) > const &intersect) const {
+	return ray_traverse(origin, direction, [&](uint32_t d, float) {
+		return intersect(*drawables[d]);
+	});
+}
+
+SceneBVH::Hit SceneBVH::ray_traverse(glm::vec3 const &origin, glm::vec3 const &direction,
+	std::function< float(uint32_t, float) > const &test) const {
+
+	Hit hit;
+	if (nodes.empty()) return hit;
+
+	glm::vec3 inv_direction = glm::vec3(1.0f) / direction; //(infinities are fine for the slab test)
+
+	//entry distance of the ray into a box, or infinity if it misses (or enters beyond 'limit'):
+	auto enter = [&](glm::vec3 const &min, glm::vec3 const &max, float limit) {
+		glm::vec3 t0 = (min - origin) * inv_direction;
+		glm::vec3 t1 = (max - origin) * inv_direction;
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+		float t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+		float t_exit = std::min(std::min(t_far.x, t_far.y), t_far.z);
+		if (t_enter <= t_exit && t_enter < limit) return t_enter;
+		return std::numeric_limits< float >::infinity();
+	};
+
+	//depth-first, visiting the nearer child first and skipping boxes beyond the best hit so far:
+	std::vector< std::pair< float, uint32_t > > stack;
+	stack.emplace_back(enter(nodes[0].min, nodes[0].max, hit.t), 0);
+	while (!stack.empty()) {
+		float t_node = stack.back().first;
+		Node const &node = nodes[stack.back().second];
+		stack.pop_back();
+		if (!(t_node < hit.t)) continue;
+
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				uint32_t d = order[i];
+				float t = enter(drawable_min[d], drawable_max[d], hit.t);
+				if (t < hit.t) t = test(d, t);
+				if (t < hit.t) {
+					hit.t = t;
+					hit.drawable = drawables[d];
+				}
+			}
+		} else {
+			float t_left = enter(nodes[node.first].min, nodes[node.first].max, hit.t);
+			float t_right = enter(nodes[node.right].min, nodes[node.right].max, hit.t);
+			//push the farther child first so the nearer one is visited first:
+			if (t_left < t_right) {
+				stack.emplace_back(t_right, node.right);
+				stack.emplace_back(t_left, node.first);
+			} else {
+				stack.emplace_back(t_left, node.first);
+				stack.emplace_back(t_right, node.right);
+			}
+		}
+	}
+
+	return hit;
+}
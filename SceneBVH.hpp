@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+ * A SceneBVH is a bounding volume hierarchy over the world-space bounding boxes
+ *  (Drawable::min/max transformed to world space) of a scene's drawables.
+ *
+ * It is useful for culling and picking in scenes with many drawables:
+ *  - update() rebuilds the tree if the drawables list changed, otherwise refits boxes to moved transforms
+ *  - frustum_query() finds drawables that might be visible (pass these to Scene::draw)
+ *  - ray_query() finds the nearest drawable box hit by a ray
+ *  - ray_intersect() finds the nearest drawable hit by a ray, using an exact test on the drawables whose boxes it hits
+ *
+ * Drawables without bounds (min > max) are never culled and never hit by rays.
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <limits>
+#include <vector>
+
+struct SceneBVH {
+	//build the tree over all of scene's drawables (call when the drawables list changes):
+	void build(Scene const &scene);
+
+	//recompute boxes for the current tree structure (call when transforms move):
+	void refit();
+
+	//build() if scene's drawables differ from the ones the tree was built over, otherwise refit():
+	void update(Scene const &scene);
+
+	//append drawables whose boxes are (at least partly) inside the clip volume of world_to_clip (in scene.drawables order):
+	void frustum_query(glm::mat4 const &world_to_clip, std::vector< Scene::Drawable const * > *visible) const;
+
+	//find the nearest box hit by the ray origin + t * direction (t >= 0), optionally only considering some drawables:
+	struct Hit {
+		Scene::Drawable const *drawable = nullptr; //nullptr if nothing was hit
+		float t = std::numeric_limits< float >::infinity(); //distance along the ray (in units of 'direction')
+	};
+	Hit ray_query(glm::vec3 const &origin, glm::vec3 const &direction,
+		std::function< bool(Scene::Drawable const &) > const &filter = nullptr) const;
+
+	//find the nearest drawable hit by the ray, where 'intersect' returns where the ray hits a drawable (infinity if it misses)
+	// and is only called for drawables whose boxes the ray hits before the best hit so far:
+	Hit ray_intersect(glm::vec3 const &origin, glm::vec3 const &direction,
+		std::function< float(Scene::Drawable const &) > const &intersect) const;
+
+	//-- internals --
+
+	//drawables the tree was built over, along with their current world-space boxes:
+	std::vector< Scene::Drawable const * > drawables;
+	std::vector< glm::vec3 > drawable_min, drawable_max;
+	std::vector< Scene::Drawable const * > unbounded; //drawables without bounds (always "visible")
+	std::vector< uint32_t > drawable_rank, unbounded_rank; //positions of 'drawables' and 'unbounded' in scene.drawables
+
+	//nodes are stored depth-first, so children always come after their parent:
+	struct Node {
+		glm::vec3 min, max;
+		uint32_t first = 0; //leaf: first entry in 'order'; interior: index of left child
+		uint32_t count = 0; //leaf: number of entries in 'order'; interior: 0
+		uint32_t right = 0; //interior: index of right child
+	};
+	std::vector< Node > nodes;
+	std::vector< uint32_t > order; //indices into 'drawables', grouped by leaf
+
+	enum : uint32_t { LeafSize = 4 }; //most drawables stored in a leaf
+
+	//shared by ray_query() and ray_intersect(); 'test' gets a drawable index and the ray's distance to its box:
+	Hit ray_traverse(glm::vec3 const &origin, glm::vec3 const &direction,
+		std::function< float(uint32_t, float) > const &test) const;
+};
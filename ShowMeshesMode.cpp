@@ -28,6 +28,8 @@ ShowMeshesMode::ShowMeshesMode(MeshBuffer const &buffer_) : buffer(buffer_) {
 		scene_drawable->pipeline.type = GL_TRIANGLES;
 		scene_drawable->pipeline.start = 0;
 		scene_drawable->pipeline.count = 0;
+		scene_drawable->pipeline.index_type = GL_NONE;
+		scene_drawable->pipeline.dequantize = glm::mat4x3(1.0f);
 	}
 
 	//select first mesh in buffer:
@@ -161,6 +163,9 @@ void ShowMeshesMode::select_prev_mesh() {
 		scene_drawable->pipeline.type = f->second.type;
 		scene_drawable->pipeline.start = f->second.start;
 		scene_drawable->pipeline.count = f->second.count;
+		scene_drawable->pipeline.index_type = f->second.index_type;
+		scene_drawable->pipeline.index_start = f->second.index_start;
+		scene_drawable->pipeline.dequantize = f->second.dequantize;
 		current_mesh_min = f->second.min;
 		current_mesh_max = f->second.max;
 	} else {
@@ -168,6 +173,8 @@ void ShowMeshesMode::select_prev_mesh() {
 		scene_drawable->pipeline.type = GL_TRIANGLES;
 		scene_drawable->pipeline.start = 0;
 		scene_drawable->pipeline.count = 0;
+		scene_drawable->pipeline.index_type = GL_NONE;
+		scene_drawable->pipeline.dequantize = glm::mat4x3(1.0f);
 		current_mesh_min = glm::vec3(0.0f);
 		current_mesh_max = glm::vec3(0.0f);
 	}
@@ -190,6 +197,9 @@ void ShowMeshesMode::select_next_mesh() {
 		scene_drawable->pipeline.type = f->second.type;
 		scene_drawable->pipeline.start = f->second.start;
 		scene_drawable->pipeline.count = f->second.count;
+		scene_drawable->pipeline.index_type = f->second.index_type;
+		scene_drawable->pipeline.index_start = f->second.index_start;
+		scene_drawable->pipeline.dequantize = f->second.dequantize;
 		current_mesh_min = f->second.min;
 		current_mesh_max = f->second.max;
 	} else {
@@ -197,6 +207,8 @@ void ShowMeshesMode::select_next_mesh() {
 		scene_drawable->pipeline.type = GL_TRIANGLES;
 		scene_drawable->pipeline.start = 0;
 		scene_drawable->pipeline.count = 0;
+		scene_drawable->pipeline.index_type = GL_NONE;
+		scene_drawable->pipeline.dequantize = glm::mat4x3(1.0f);
 		current_mesh_min = glm::vec3(0.0f);
 		current_mesh_max = glm::vec3(0.0f);
 	}
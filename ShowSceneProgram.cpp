@@ -1,11 +1,12 @@
 #include "ShowSceneProgram.hpp"
 
+#include "Mesh.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline show_scene_program_pipeline;
 
-Load< ShowSceneProgram > show_scene_program(LoadTagEarly, []() -> ShowSceneProgram * {
+Load< ShowSceneProgram > show_scene_program("show_scene_program", LoadTagEarly, []() -> ShowSceneProgram * {
 	auto *ret = new ShowSceneProgram();
 
 	show_scene_program_pipeline.program = ret->program;
@@ -27,16 +28,22 @@ ShowSceneProgram::ShowSceneProgram() {
 		"uniform mat3 NORMAL_TO_LIGHT;\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
+		"in vec2 NormalOct;\n" //octahedral-encoded normal (quantized meshes; see Mesh.hpp)
 		"in vec4 Color;\n"
 		"in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"vec3 oct_decode(vec2 e) {\n"
+		"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+		"	if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+		"	return normalize(n);\n"
+		"}\n"
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"	normal = NORMAL_TO_LIGHT * (dot(Normal,Normal) > 0.0 ? Normal : oct_decode(NormalOct));\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
@@ -76,6 +83,7 @@ ShowSceneProgram::ShowSceneProgram() {
 	//look up the locations of vertex attributes:
 	Position_vec4 = glGetAttribLocation(program, "Position");
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
+	NormalOct_vec2 = glGetAttribLocation(program, "NormalOct");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
@@ -88,6 +96,7 @@ ShowSceneProgram::ShowSceneProgram() {
 }
 
 ShowSceneProgram::~ShowSceneProgram() {
+	MeshBuffer::forget_program(program);
 	glDeleteProgram(program);
 	program = 0;
 }
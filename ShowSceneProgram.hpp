@@ -16,6 +16,7 @@ struct ShowSceneProgram {
 	//Attribute (per-vertex variable) locations:
 	GLuint Position_vec4 = -1U;
 	GLuint Normal_vec3 = -1U;
+	GLuint NormalOct_vec2 = -1U; //(used instead of Normal by quantized meshes)
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
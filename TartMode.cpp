@@ -12,18 +12,77 @@
 #include <glm/ext.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#include <algorithm>
+#include <array>
+#include <map>
+#include <utility>
 #include <random>
+#include <unordered_map>
 
 GLuint tart_meshes_for_lit_color_texture_program = 0;
-Load< MeshBuffer > tart_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("tart.pnct"));
-	tart_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+GLuint tart_meshes_for_lit_color_texture_program_instanced = 0;
+//triangles of each mesh (read before the meshes are uploaded), so clicks can be picked against the tart's surface:
+std::unordered_map< std::string, std::vector< glm::vec3 > > tart_mesh_triangles; //by mesh name
+std::unordered_map< std::string, std::string > tart_transform_meshes; //transform name -> mesh name
+std::unordered_map< std::string, bool > tart_mesh_closed; //by mesh name (see closed_triangles)
+
+//is every edge of a mesh's triangles shared with a triangle that runs along it the other way?
+// (only closed meshes can have their back faces culled; the fruit slices, for one, are open and can be turned around)
+// Corners of indexed meshes are matched by vertex index, with the vertices split at normal or texture seams
+//  (which share a position) counted as one; un-indexed meshes give each triangle its own vertices, so they are matched by position.
+template< typename Corner >
+static bool closed_corners(std::vector< Corner > const &corners) {
+	std::vector< std::pair< Corner, Corner > > edges, reversed;
+	for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+		for (uint32_t k = 0; k < 3; ++k) {
+			Corner const &a = corners[i + k];
+			Corner const &b = corners[i + (k + 1) % 3];
+			edges.emplace_back(a, b);
+			reversed.emplace_back(b, a);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::sort(reversed.begin(), reversed.end());
+	return !edges.empty() && edges == reversed;
+}
+
+static bool closed_triangles(MeshBuffer const &meshes, Mesh const &mesh, std::vector< glm::vec3 > const &corners) {
+	if (mesh.index_type != GL_NONE) {
+		std::vector< uint32_t > vertices;
+		meshes.read_triangle_vertices(mesh, &vertices);
+		//first vertex seen at each position:
+		std::map< std::array< float, 3 >, uint32_t > seam_vertex;
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			glm::vec3 const &corner = corners[i];
+			vertices[i] = seam_vertex.emplace(std::array< float, 3 >{{ corner.x, corner.y, corner.z }}, vertices[i]).first->second;
+		}
+		return closed_corners(vertices);
+	} else {
+		std::vector< std::array< float, 3 > > positions;
+		for (auto const &corner : corners) positions.push_back({{ corner.x, corner.y, corner.z }});
+		return closed_corners(positions);
+	}
+}
+
+//(the file is read on a worker thread; only the upload and VAO creation happen on the GL thread)
+Load< MeshBuffer > tart_meshes("tart_meshes", LoadTagDefault, []() -> MeshBuffer * {
+	MeshBuffer *meshes = new MeshBuffer(data_path("tart.pnct"), MeshBuffer::DeferUpload);
+	for (auto const &m : meshes->meshes) {
+		meshes->read_triangles(m.second, &tart_mesh_triangles[m.first]);
+		tart_mesh_closed[m.first] = closed_triangles(*meshes, m.second, tart_mesh_triangles[m.first]);
+	}
+	return meshes;
+}, [](MeshBuffer &meshes) {
+	meshes.upload();
+	tart_meshes_for_lit_color_texture_program = meshes.make_vao_for_program(lit_color_texture_program->program);
+	tart_meshes_for_lit_color_texture_program_instanced = meshes.make_vao_for_program(lit_color_texture_program_instanced->program);
 });
 
-Load< Scene > tart_scene(LoadTagDefault, []() -> Scene const * {
+//(parsing the scene doesn't touch OpenGL, so it can happen on a worker thread once the meshes are loaded)
+Load< Scene > tart_scene("tart_scene", LoadTagDefault, []() -> Scene const * {
 	return new Scene(data_path("tart.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 		Mesh const &mesh = tart_meshes->lookup(mesh_name);
+		tart_transform_meshes[transform->name] = mesh_name;
 
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable &drawable = scene.drawables.back();
@@ -31,12 +90,29 @@ Load< Scene > tart_scene(LoadTagDefault, []() -> Scene const * {
 		drawable.pipeline = lit_color_texture_program_pipeline;
 
 		drawable.pipeline.vao = tart_meshes_for_lit_color_texture_program;
+		drawable.pipeline.instanced_vao = tart_meshes_for_lit_color_texture_program_instanced;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.index_start = mesh.index_start;
+		drawable.pipeline.dequantize = mesh.dequantize;
+		drawable.pipeline.meshlets = mesh.meshlets;
+		drawable.pipeline.meshlet_count = mesh.meshlet_count;
+		drawable.pipeline.cull_back_faces = tart_mesh_closed.at(mesh_name);
+		for (uint32_t l = 0; l < mesh.lods.size() && l < Scene::Drawable::Pipeline::MaxLODs; ++l) {
+			drawable.pipeline.lods[l].start = mesh.lods[l].start;
+			drawable.pipeline.lods[l].count = mesh.lods[l].count;
+			drawable.pipeline.lods[l].index_start = mesh.lods[l].index_start;
+			drawable.pipeline.lods[l].dequantize = mesh.lods[l].dequantize;
+			drawable.pipeline.lods[l].max_size = mesh.lods[l].max_size;
+		}
+
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
 
 	});
-});
+}, LoadOnAnyThread, { &tart_meshes });
 
 TartMode::TartMode() : scene(*tart_scene) {
 	// Helper to setup fruit
@@ -125,11 +201,41 @@ TartMode::TartMode() : scene(*tart_scene) {
 	for (auto &fruit : fruits) {
 		fruit.transform->position = hidden_fruit_pos;
 	}
+
+	// Pick throw destinations against the tart's actual triangles
+	for (Scene::Transform const *transform : { tart.base, tart.rim, tart.cream }) {
+		pick_triangles[transform] = &tart_mesh_triangles.at(tart_transform_meshes.at(transform->name));
+	}
+
+	bvh.build(scene);
 }
 
 TartMode::~TartMode() {
 }
 
+// Distance along the ray origin + t * direction (t >= 0) to the nearest of the triangles, or infinity if it misses them all
+// (Moller-Trumbore intersection; triangles are hit from either side)
+float TartMode::ray_triangles(glm::vec3 const &origin, glm::vec3 const &direction, std::vector< glm::vec3 > const &corners) {
+	float best = std::numeric_limits< float >::infinity();
+	for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+		glm::vec3 e1 = corners[i+1] - corners[i];
+		glm::vec3 e2 = corners[i+2] - corners[i];
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (std::abs(det) < 1e-12f) continue; // ray is parallel to triangle
+		float inv_det = 1.0f / det;
+		glm::vec3 s = origin - corners[i];
+		float u = glm::dot(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f) continue;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f) continue;
+		float t = glm::dot(e2, q) * inv_det;
+		if (t >= 0.0f && t < best) best = t;
+	}
+	return best;
+}
+
 int8_t TartMode::get_next_available_index() {
 	uint8_t next_temp = (current_fruit_index + 1) % fruits.size(); // Start at wraparound index
 	while (next_temp != current_fruit_index) {
@@ -312,9 +418,26 @@ bool TartMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 				glm::vec3 ray_world = glm::vec3(glm::mat4(camera->transform->make_local_to_world()) * ray_camera);
 				ray_world = glm::normalize(ray_world);	// Normalize
 
-				float time = (tart_base_depth - current_fruit.transform->position.z) / ray_world.z; // time at which fruit hits plane
-				glm::vec3 dest = (ray_world * time) + current_fruit.transform->position;
-				dest.z = tart_base_depth; // Fruits intersect tart plane at the level of its base (z-axis)
+				// Pick against the tart's triangles along the ray from the camera (the BVH narrows it down to the pieces whose boxes are hit)
+				glm::vec3 camera_position = camera->transform->make_local_to_world()[3];
+				bvh.update(scene);
+				SceneBVH::Hit hit = bvh.ray_intersect(camera_position, ray_world, [&](Scene::Drawable const &drawable) {
+					auto f = pick_triangles.find(drawable.transform);
+					if (f == pick_triangles.end()) return std::numeric_limits< float >::infinity();
+					// (an affine transform keeps distances along the ray, so test in the piece's local space)
+					glm::mat4x3 world_to_local = drawable.transform->make_world_to_local();
+					return ray_triangles(world_to_local * glm::vec4(camera_position, 1.0f), world_to_local * glm::vec4(ray_world, 0.0f), *f->second);
+				});
+
+				glm::vec3 dest;
+				if (hit.drawable) {
+					dest = camera_position + ray_world * hit.t;
+				} else {
+					// Missed the tart, so fall back to intersecting the plane at the level of its base
+					float time = (tart_base_depth - current_fruit.transform->position.z) / ray_world.z; // time at which fruit hits plane
+					dest = (ray_world * time) + current_fruit.transform->position;
+					dest.z = tart_base_depth; // Fruits intersect tart plane at the level of its base (z-axis)
+				}
 
 				// After loading fruit, the fruit is ready to be thrown
 				current_fruit.dest_position = dest;
@@ -402,14 +525,6 @@ void TartMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	glUseProgram(0);
-
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -419,6 +534,14 @@ void TartMode::draw(glm::uvec2 const &drawable_size) {
 
 	GL_ERRORS(); //print any errors produced by this setup code
 
+	//scenes with lots of lamps use clustered lighting instead of per-drawable light lists:
+	if (scene.lights.size() > Scene::MaxLights) {
+		light_clusters.update(scene, *camera, drawable_size);
+		scene.light_clusters = &light_clusters;
+	} else {
+		scene.light_clusters = nullptr;
+	}
+
 	scene.draw(*camera);
 
 	{ //use DrawLines to overlay some text:
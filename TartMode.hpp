@@ -1,6 +1,8 @@
 #include "Mode.hpp"
 
 #include "Scene.hpp"
+#include "SceneBVH.hpp"
+#include "LightClusters.hpp"
 
 #include <glm/glm.hpp>
 
@@ -9,6 +11,7 @@
 #include <array>
 #include <deque>
 #include <stack>
+#include <unordered_map>
 
 struct TartMode : Mode {
 	TartMode();
@@ -74,6 +77,15 @@ struct TartMode : Mode {
 	float tart_base_depth = 1.0f;
 	glm::vec3 hidden_fruit_pos;
 
+	// Bounding volume hierarchy over the scene's drawables, used to pick throw destinations
+	SceneBVH bvh;
+	// ...and the triangles (in local space) of the tart pieces fruit can land on
+	std::unordered_map< Scene::Transform const *, std::vector< glm::vec3 > const * > pick_triangles;
+	static float ray_triangles(glm::vec3 const &origin, glm::vec3 const &direction, std::vector< glm::vec3 > const &corners);
+
+	// Per-frame light binning, used when the scene has more lights than fit in Scene::FrameBlock
+	LightClusters light_clusters;
+
 	// Collisions/throwing constants
 	const float collision_delta = 1.5f;
 	const float speed = 10.0f;
@@ -0,0 +1,116 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+WorkerPool::WorkerPool(uint32_t thread_count) {
+	if (thread_count == 0) {
+		uint32_t hardware = std::thread::hardware_concurrency();
+		thread_count = (hardware > 1 ? hardware - 1 : 1);
+	}
+	threads.reserve(thread_count);
+	for (uint32_t i = 0; i < thread_count; ++i) {
+		threads.emplace_back([this](){
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				job_ready.wait(lock, [this](){ return quit || !jobs.empty(); });
+				if (jobs.empty()) break; //quit, and nothing left to do
+				std::function< void() > job = std::move(jobs.front());
+				jobs.pop_front();
+
+				lock.unlock();
+				job();
+				lock.lock();
+
+				pending -= 1;
+				if (pending == 0) jobs_done.notify_all();
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	job_ready.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::run(std::function< void() > const &job) {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		assert(!quit && "shouldn't queue jobs on a pool that is shutting down");
+		jobs.emplace_back(job);
+		pending += 1;
+	}
+	job_ready.notify_one();
+}
+
+void WorkerPool::wait() {
+	std::unique_lock< std::mutex > lock(mutex);
+	jobs_done.wait(lock, [this](){ return pending == 0; });
+}
+
+void WorkerPool::parallel_for(size_t count, size_t min_chunk, std::function< void(size_t, size_t) > const &fn) {
+	min_chunk = std::max< size_t >(1, min_chunk);
+	if (count <= min_chunk || threads.empty()) {
+		if (count) fn(0, count);
+		return;
+	}
+
+	//split into a few chunks per thread so uneven work balances out:
+	size_t chunk = std::max(min_chunk, count / ((threads.size() + 1) * 4));
+	size_t chunks = (count + chunk - 1) / chunk;
+
+	//workers and the calling thread all grab chunks from a shared counter:
+	std::atomic< size_t > next_chunk(0);
+	auto work = [&]() {
+		while (true) {
+			size_t c = next_chunk.fetch_add(1);
+			if (c >= chunks) break;
+			fn(c * chunk, std::min(count, (c + 1) * chunk));
+		}
+	};
+
+	//helpers reference this stack frame, so track them separately from other queued jobs:
+	// a helper that only starts after the caller has run out of chunks does nothing and never touches the frame,
+	// so the caller just waits for helpers that actually started (jobs that call parallel_for can't deadlock the pool)
+	struct Helpers {
+		std::mutex mutex;
+		std::condition_variable done;
+		size_t running = 0;
+		bool finished = false;
+	};
+	std::shared_ptr< Helpers > state = std::make_shared< Helpers >();
+	size_t helpers = std::min(threads.size(), chunks - 1);
+	for (size_t h = 0; h < helpers; ++h) {
+		run([state,&work]() {
+			{
+				std::unique_lock< std::mutex > lock(state->mutex);
+				if (state->finished) return;
+				state->running += 1;
+			}
+			work();
+			std::unique_lock< std::mutex > lock(state->mutex);
+			state->running -= 1;
+			if (state->running == 0) state->done.notify_all();
+		});
+	}
+
+	work();
+
+	std::unique_lock< std::mutex > lock(state->mutex);
+	state->done.wait(lock, [&](){ return state->running == 0; });
+	state->finished = true;
+}
+
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * A WorkerPool runs jobs on a fixed set of background threads.
+ *
+ * It is used for work that can be split into independent pieces,
+ *  e.g., updating all transforms at one depth of a scene hierarchy.
+ *
+ * Jobs must not touch OpenGL, since the context is only current on the main thread.
+ *
+ */
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct WorkerPool {
+	//start a pool with the given number of worker threads:
+	// (0 => one fewer than the number of hardware threads, since the calling thread also helps in parallel_for)
+	WorkerPool(uint32_t thread_count = 0);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//queue a job to run on some worker thread:
+	void run(std::function< void() > const &job);
+
+	//wait until every queued job has finished:
+	void wait();
+
+	//call fn(begin, end) over sub-ranges of [0,count) on the workers and the calling thread; returns when all are done:
+	// ranges are at least 'min_chunk' long, so small counts just run on the calling thread.
+	// (may be called from inside a job running on the pool)
+	void parallel_for(size_t count, size_t min_chunk, std::function< void(size_t begin, size_t end) > const &fn);
+
+	//number of worker threads (not counting the caller):
+	uint32_t size() const { return uint32_t(threads.size()); }
+
+	//pool shared by all code that doesn't need its own (created on first use):
+	static WorkerPool &shared();
+
+	//-- internals --
+	std::vector< std::thread > threads;
+	std::mutex mutex;
+	std::condition_variable job_ready; //signaled when a job is queued (or on quit)
+	std::condition_variable jobs_done; //signaled when 'pending' reaches zero
+	std::deque< std::function< void() > > jobs;
+	size_t pending = 0; //jobs queued or running
+	bool quit = false;
+};
@@ -0,0 +1,483 @@
+//bench: CPU microbenchmarks for the scene, mesh, and file code (no window or OpenGL context needed).
+// Each section sweeps a problem size and prints best-of-several timings; run with section names to pick some:
+//   ./bench [transforms] [bvh] [lights] [lz4] [names]
+// (build with optimization on; the numbers are only meaningful relative to each other on one machine)
+
+#include "Scene.hpp"
+#include "SceneBVH.hpp"
+#include "LightClusters.hpp"
+#include "Mesh.hpp"
+#include "read_write_chunk.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//keeps results "used" so the optimizer can't drop the work being timed:
+static volatile float sink = 0.0f;
+
+//best time over 'reps' runs of fn, in milliseconds:
+static float best_ms(uint32_t reps, std::function< void() > const &fn) {
+	float best = std::numeric_limits< float >::infinity();
+	for (uint32_t r = 0; r < reps; ++r) {
+		auto before = std::chrono::high_resolution_clock::now();
+		fn();
+		auto after = std::chrono::high_resolution_clock::now();
+		best = std::min(best, std::chrono::duration< float, std::milli >(after - before).count());
+	}
+	return best;
+}
+
+//-- transforms --
+// world matrices of a random hierarchy (every transform moves each frame, or one in 16 does),
+//  stored both in a std::list< Scene::Transform > (the layout Scene used before TransformArray) and in a Scene's TransformArray:
+//  'walk' rebuilds each matrix by walking up to the root (no caching),
+//  'lazy' calls make_local_to_world() on each transform (cached, dirty-checked per node),
+//  'update' calls Scene::update_world_matrices() (one pass over the TransformArray), then reads each matrix.
+static void bench_transforms() {
+	std::cout << "transforms: ns per transform per frame\n";
+	std::cout << "  " << std::setw(8) << "count" << std::setw(8) << "moving"
+	          << std::setw(11) << "list:walk" << std::setw(10) << "lazy"
+	          << std::setw(12) << "array:walk" << std::setw(10) << "lazy" << std::setw(10) << "update" << "\n";
+	for (uint32_t count : { 1000u, 10000u, 100000u }) {
+		Scene scene;
+		std::list< Scene::Transform > list;
+		std::vector< Scene::Transform * > listed; //list transforms, in the same order as scene.transforms
+		std::mt19937 mt(0x1234);
+		for (uint32_t i = 0; i < count; ++i) {
+			Scene::Transform &transform = scene.transforms.emplace_back();
+			list.emplace_back();
+			Scene::Transform &copy = list.back();
+			listed.emplace_back(&copy);
+			transform.name = copy.name = "Transform." + std::to_string(i);
+			transform.position = copy.position = glm::vec3(float(mt() % 100) * 0.01f, 0.0f, 1.0f);
+			transform.rotation = copy.rotation = glm::normalize(glm::quat(1.0f, 0.1f * float(mt() % 10), 0.0f, 0.2f));
+			//a forest of small trees, parents stored before their children:
+			if (i % 16 != 0) {
+				uint32_t parent = i - 1 - mt() % (i % 16);
+				transform.parent = &scene.transforms[parent];
+				copy.parent = listed[parent];
+			}
+		}
+
+		for (uint32_t stride : { 1u, 16u }) {
+			uint32_t frame = 0;
+			auto move = [&]() {
+				frame += 1;
+				for (uint32_t i = frame % stride; i < count; i += stride) {
+					scene.transforms[i].position.x += 0.001f;
+					listed[i]->position.x += 0.001f;
+				}
+			};
+			auto walk = [&](auto const &transforms) {
+				return best_ms(5, [&]() {
+					move();
+					float sum = 0.0f;
+					for (auto const &transform : transforms) {
+						glm::mat4x3 local_to_world = transform.make_local_to_parent();
+						for (Scene::Transform const *t = transform.parent; t; t = t->parent) {
+							local_to_world = t->make_local_to_parent() * glm::mat4(local_to_world);
+						}
+						sum += local_to_world[3].x;
+					}
+					sink = sum;
+				});
+			};
+			auto lazy = [&](auto const &transforms) {
+				return best_ms(5, [&]() {
+					move();
+					float sum = 0.0f;
+					for (auto const &transform : transforms) sum += transform.make_local_to_world()[3].x;
+					sink = sum;
+				});
+			};
+			float list_walk = walk(list);
+			float list_lazy = lazy(list);
+			float array_walk = walk(scene.transforms);
+			float array_lazy = lazy(scene.transforms);
+			float update = best_ms(5, [&]() {
+				move();
+				scene.update_world_matrices();
+				float sum = 0.0f;
+				for (auto const &transform : scene.transforms) sum += transform.make_local_to_world()[3].x;
+				sink = sum;
+			});
+			float to_ns = 1e6f / float(count);
+			std::cout << "  " << std::setw(8) << count << std::setw(8) << ("1/" + std::to_string(stride))
+			          << std::fixed << std::setprecision(1)
+			          << std::setw(11) << list_walk * to_ns << std::setw(10) << list_lazy * to_ns
+			          << std::setw(12) << array_walk * to_ns << std::setw(10) << array_lazy * to_ns << std::setw(10) << update * to_ns << "\n";
+			std::cout.unsetf(std::ios::fixed);
+		}
+	}
+}
+
+//-- bvh --
+// drawables (unit boxes) scattered through a cube, seen by a camera in the middle of it:
+//  SceneBVH::build() and SceneBVH::refit() (after moving every drawable, or one in 16) in milliseconds,
+//  frustum queries through SceneBVH::frustum_query vs. testing every drawable's world box against the clip planes,
+//  and nearest-box ray queries through SceneBVH::ray_query vs. slab-testing every box, in microseconds per query.
+// (the linear ray baseline is skipped at 1M drawables, where it would take minutes; it prints as '-')
+static void bench_bvh() {
+	std::cout << "bvh: build/refit milliseconds, microseconds per query\n";
+	std::cout << "  " << std::setw(8) << "count" << std::setw(9) << "build" << std::setw(9) << "refit" << std::setw(9) << "1/16"
+	          << std::setw(10) << "visible" << std::setw(12) << "frustum:bvh" << std::setw(10) << "linear"
+	          << std::setw(10) << "ray:bvh" << std::setw(10) << "linear" << "\n";
+	for (uint32_t count : { 10000u, 100000u, 1000000u }) {
+		Scene scene;
+		std::mt19937 mt(0x5678);
+		float extent = 2.0f * std::cbrt(float(count)); //(keeps density constant)
+		auto coord = [&]() { return (float(mt() % 10000) / 5000.0f - 1.0f) * extent; };
+		for (uint32_t i = 0; i < count; ++i) {
+			Scene::Transform &transform = scene.transforms.emplace_back();
+			transform.position = glm::vec3(coord(), coord(), coord());
+			scene.drawables.emplace_back(&transform);
+			scene.drawables.back().min = glm::vec3(-0.5f);
+			scene.drawables.back().max = glm::vec3(0.5f);
+		}
+
+		SceneBVH bvh;
+		float build = best_ms(5, [&]() {
+			bvh.build(scene);
+		});
+
+		uint32_t frame = 0;
+		auto refit = [&](uint32_t stride) {
+			return best_ms(5, [&]() {
+				frame += 1;
+				for (uint32_t i = frame % stride; i < count; i += stride) {
+					scene.transforms[i].position.x += (frame % 2 ? 0.01f : -0.01f);
+				}
+				bvh.refit();
+			});
+		};
+		float refit_all = refit(1);
+		float refit_some = refit(16);
+
+		//camera at the center, looking along +x:
+		Scene::Transform &eye = scene.transforms.emplace_back();
+		eye.position = glm::vec3(0.0f);
+		eye.rotation = glm::angleAxis(-0.5f * 3.1415926f, glm::vec3(0.0f, 1.0f, 0.0f));
+		Scene::Camera camera(&eye);
+		camera.aspect = 16.0f / 9.0f;
+		glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(eye.make_world_to_local());
+
+		std::vector< Scene::Drawable const * > visible;
+		float frustum_bvh = best_ms(20, [&]() {
+			visible.clear();
+			bvh.frustum_query(world_to_clip, &visible);
+		});
+		std::vector< Scene::Drawable const * > bvh_visible = visible;
+
+		//(same plane test as SceneBVH, one box at a time)
+		glm::vec4 r0 = glm::vec4(world_to_clip[0][0], world_to_clip[1][0], world_to_clip[2][0], world_to_clip[3][0]);
+		glm::vec4 r1 = glm::vec4(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1], world_to_clip[3][1]);
+		glm::vec4 r2 = glm::vec4(world_to_clip[0][2], world_to_clip[1][2], world_to_clip[2][2], world_to_clip[3][2]);
+		glm::vec4 r3 = glm::vec4(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+		glm::vec4 planes[6] = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+		float frustum_linear = best_ms(20, [&]() {
+			visible.clear();
+			for (uint32_t i = 0; i < bvh.drawables.size(); ++i) {
+				glm::vec3 const &min = bvh.drawable_min[i];
+				glm::vec3 const &max = bvh.drawable_max[i];
+				bool outside = false;
+				for (auto const &plane : planes) {
+					glm::vec3 n = glm::vec3(plane);
+					glm::vec3 far_corner = glm::vec3(n.x > 0.0f ? max.x : min.x, n.y > 0.0f ? max.y : min.y, n.z > 0.0f ? max.z : min.z);
+					if (glm::dot(n, far_corner) + plane.w < 0.0f) {
+						outside = true;
+						break;
+					}
+				}
+				if (!outside) visible.emplace_back(bvh.drawables[i]);
+			}
+		});
+		if (visible != bvh_visible) std::cout << "  (frustum results differ: bvh " << bvh_visible.size() << ", linear " << visible.size() << ")\n";
+
+		//rays from the camera toward random points in the cube:
+		enum : uint32_t { Rays = 1000 };
+		std::vector< glm::vec3 > directions;
+		for (uint32_t r = 0; r < Rays; ++r) directions.emplace_back(glm::vec3(coord(), coord(), coord()) - eye.position);
+		uint32_t bvh_hits = 0, linear_hits = 0;
+		float ray_bvh = best_ms(5, [&]() {
+			bvh_hits = 0;
+			for (auto const &direction : directions) {
+				if (bvh.ray_query(eye.position, direction).drawable) bvh_hits += 1;
+			}
+		});
+		bool skip_linear = (count >= 1000000u);
+		float ray_linear = skip_linear ? 0.0f : best_ms(5, [&]() {
+			linear_hits = 0;
+			for (auto const &direction : directions) {
+				glm::vec3 inv_direction = glm::vec3(1.0f) / direction;
+				float best = std::numeric_limits< float >::infinity();
+				for (uint32_t i = 0; i < bvh.drawables.size(); ++i) {
+					glm::vec3 t0 = (bvh.drawable_min[i] - eye.position) * inv_direction;
+					glm::vec3 t1 = (bvh.drawable_max[i] - eye.position) * inv_direction;
+					glm::vec3 t_near = glm::min(t0, t1);
+					glm::vec3 t_far = glm::max(t0, t1);
+					float t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+					float t_exit = std::min(std::min(t_far.x, t_far.y), t_far.z);
+					if (t_enter <= t_exit && t_enter < best) best = t_enter;
+				}
+				if (best < std::numeric_limits< float >::infinity()) linear_hits += 1;
+			}
+		});
+		if (!skip_linear && bvh_hits != linear_hits) std::cout << "  (ray results differ: bvh " << bvh_hits << " hits, linear " << linear_hits << ")\n";
+
+		std::cout << "  " << std::setw(8) << count << std::fixed << std::setprecision(1)
+		          << std::setw(9) << build << std::setw(9) << refit_all << std::setw(9) << refit_some
+		          << std::setw(10) << bvh_visible.size()
+		          << std::setw(12) << frustum_bvh * 1e3f << std::setw(10) << frustum_linear * 1e3f
+		          << std::setw(10) << ray_bvh * 1e3f / Rays;
+		if (skip_linear) std::cout << std::setw(10) << "-" << "\n";
+		else std::cout << std::setw(10) << ray_linear * 1e3f / Rays << "\n";
+		std::cout.unsetf(std::ios::fixed);
+	}
+}
+
+//-- lights --
+// CPU time of LightClusters::bin() as the number of point and spot lights (each reaching 8 units) grows,
+//  with the lights scattered through a 100 x 100 x 20 block in front of a 1920x1080 camera:
+static void bench_lights() {
+	std::cout << "lights: binning milliseconds per frame\n";
+	std::cout << "  " << std::setw(8) << "lights" << std::setw(8) << "binned" << std::setw(10) << "indices"
+	          << std::setw(12) << "per cluster" << std::setw(10) << "ms" << "\n";
+	Scene scene;
+	Scene::Transform &eye = scene.transforms.emplace_back();
+	eye.position = glm::vec3(0.0f, 0.0f, 10.0f);
+	Scene::Camera camera(&eye);
+	camera.aspect = 16.0f / 9.0f;
+	glm::uvec2 drawable_size = glm::uvec2(1920, 1080);
+
+	LightClusters clusters(LightClusters::BinOnly);
+	std::mt19937 mt(0x9abc);
+	auto coord = [&](float extent) { return (float(mt() % 10000) / 5000.0f - 1.0f) * extent; };
+	for (uint32_t count = 16; count <= 1024; count *= 2) {
+		while (scene.lights.size() < count) {
+			Scene::Transform &transform = scene.transforms.emplace_back();
+			//(the camera looks along -z)
+			transform.position = glm::vec3(coord(50.0f), coord(50.0f), -coord(50.0f) - 50.0f);
+			scene.lights.emplace_back(&transform);
+			scene.lights.back().type = (scene.lights.size() % 4 == 0 ? Scene::Light::Spot : Scene::Light::Point);
+			scene.lights.back().distance = 8.0f;
+		}
+		float ms = std::numeric_limits< float >::infinity();
+		for (uint32_t r = 0; r < 20; ++r) {
+			clusters.bin(scene, camera, drawable_size);
+			ms = std::min(ms, clusters.binning_ms);
+		}
+		uint32_t clusters_used = 0; //(clusters with any lights)
+		for (auto const &range : clusters.ranges) {
+			if (range.y) clusters_used += 1;
+		}
+		std::cout << "  " << std::setw(8) << count << std::setw(8) << clusters.binned_count << std::setw(10) << clusters.index_count
+		          << std::fixed << std::setprecision(2)
+		          << std::setw(12) << (clusters_used ? float(clusters.index_count) / float(clusters_used) : 0.0f) << std::setw(10) << ms << "\n";
+		std::cout.unsetf(std::ios::fixed);
+	}
+}
+
+//-- lz4 --
+// reading one big chunk out of an in-memory file (so no disk time is included -- on a slow disk, reading the
+//  smaller compressed file saves about 'ratio' of the I/O on top of this), into memory the loader can keep:
+//  'raw' copies an uncompressed chunk out of the file, 'serial' and 'parallel' decode a compressed one
+//  (ChunkReader::parallel_decode off and on). Payloads are mesh-like vertex data, random bytes, and zeros:
+static void bench_lz4() {
+	std::cout << "lz4: MB/s of chunk data read (workers: " << WorkerPool::shared().size() << ")\n";
+	std::cout << "  " << std::setw(8) << "payload" << std::setw(8) << "MiB" << std::setw(8) << "ratio"
+	          << std::setw(10) << "raw" << std::setw(10) << "serial" << std::setw(10) << "parallel" << "\n";
+	for (std::string payload : { "mesh", "random", "zeros" }) {
+		for (uint32_t mib : { 1u, 16u, 64u }) {
+			std::vector< char > data(size_t(mib) << 20, 0);
+			if (payload == "mesh") {
+				//a smooth heightfield grid, rows of 256 vertices with position, normal, color, and texture coordinate:
+				struct Vertex {
+					glm::vec3 position;
+					glm::vec3 normal;
+					glm::u8vec4 color;
+					glm::vec2 tex_coord;
+				};
+				static_assert(sizeof(Vertex) == 36, "vertex is packed");
+				Vertex *vertices = reinterpret_cast< Vertex * >(data.data());
+				for (size_t i = 0; i < data.size() / sizeof(Vertex); ++i) {
+					float x = float(i % 256) * 0.25f;
+					float y = float(i / 256) * 0.25f;
+					vertices[i].position = glm::vec3(x, y, std::sin(0.1f * x) * std::cos(0.07f * y));
+					vertices[i].normal = glm::vec3(0.0f, 0.0f, 1.0f);
+					vertices[i].color = glm::u8vec4(0xff, 0xcc, 0x88, 0xff);
+					vertices[i].tex_coord = glm::vec2(x / 64.0f, y / 64.0f);
+				}
+			} else if (payload == "random") {
+				std::mt19937 mt(0xdef0);
+				for (auto &c : data) c = char(mt());
+			}
+
+			auto make_file = [&](bool compress) {
+				ChunkFileWriter writer;
+				writer.add("data", data, compress);
+				std::ostringstream file;
+				writer.write(&file);
+				return file.str();
+			};
+			std::string raw_file = make_file(false);
+			std::string compressed_file = make_file(true);
+
+			std::vector< char > copy;
+			float raw = best_ms(5, [&]() {
+				ChunkReader reader(raw_file.data(), raw_file.data() + raw_file.size());
+				ChunkView< char > view = reader.read_chunk< char >("data");
+				copy.assign(view.begin(), view.end());
+				sink = float(copy.back());
+			});
+			auto decode = [&](bool parallel) {
+				ChunkView< char > view;
+				float ms = best_ms(5, [&]() {
+					ChunkReader reader(compressed_file.data(), compressed_file.data() + compressed_file.size());
+					reader.parallel_decode = parallel;
+					view = reader.read_chunk< char >("data");
+					sink = float(view[view.size() - 1]);
+				});
+				if (view.size() != data.size() || std::memcmp(view.data(), data.data(), data.size()) != 0) {
+					std::cout << "  (decoded " << payload << " data differs from the original)\n";
+				}
+				return ms;
+			};
+			float serial = decode(false);
+			float parallel = decode(true);
+
+			float to_mbps = float(data.size()) / 1e3f; //(bytes per ms / 1e3 = MB/s)
+			std::cout << "  " << std::setw(8) << payload << std::setw(8) << mib
+			          << std::fixed << std::setprecision(2) << std::setw(8) << float(data.size()) / float(compressed_file.size())
+			          << std::setprecision(0) << std::setw(10) << to_mbps / raw << std::setw(10) << to_mbps / serial << std::setw(10) << to_mbps / parallel << "\n";
+			std::cout.unsetf(std::ios::fixed);
+		}
+	}
+}
+
+//-- names --
+// MeshBuffer::lookup() (the open-addressing name table) vs. std::map::find on MeshBuffer::meshes (how lookup() used to work),
+//  for a mesh file with Blender-style names ("Cube.017") read by MeshBuffer; names are looked up in shuffled order,
+//  each from a std::string, as Scene::load's on_drawable callbacks do:
+static void bench_names() {
+	std::cout << "names: ns per lookup\n";
+	std::cout << "  " << std::setw(8) << "meshes" << std::setw(10) << "map" << std::setw(10) << "table" << "\n";
+	std::string filename = "bench-names.pnct"; //(written to the current directory, and removed when done)
+	for (uint32_t count : { 54u, 1040u, 30040u }) {
+		{ //a file with one triangle per mesh:
+			struct Vertex {
+				glm::vec3 Position;
+				glm::vec3 Normal;
+				glm::u8vec4 Color;
+				glm::vec2 TexCoord;
+			};
+			struct IndexEntry0 {
+				uint32_t name_begin, name_end;
+				uint32_t vertex_begin, vertex_end;
+			};
+			std::vector< Vertex > vertices(3 * count);
+			for (uint32_t v = 0; v < vertices.size(); ++v) vertices[v].Position = glm::vec3(float(v % 3), float(v % 2), 0.0f);
+			std::vector< char > strings;
+			std::vector< IndexEntry0 > index;
+			char const *bases[] = { "Cube", "Sphere", "Plane", "Cylinder", "Tart.Crust", "Fruit.Slice" };
+			for (uint32_t i = 0; i < count; ++i) {
+				char suffix[16];
+				std::snprintf(suffix, sizeof(suffix), ".%03u", i / 6);
+				std::string name = std::string(bases[i % 6]) + suffix;
+				index.emplace_back(IndexEntry0{ uint32_t(strings.size()), uint32_t(strings.size() + name.size()), 3 * i, 3 * i + 3 });
+				strings.insert(strings.end(), name.begin(), name.end());
+			}
+			std::ofstream file(filename, std::ios::binary);
+			write_chunk("pnct", vertices, &file);
+			write_chunk("str0", strings, &file);
+			write_chunk("idx0", index, &file);
+		}
+		MeshBuffer buffer(filename, MeshBuffer::DeferUpload); //(no OpenGL calls until upload(), which isn't needed here)
+
+		std::vector< std::string > names;
+		for (auto const &m : buffer.meshes) names.emplace_back(m.first);
+		std::shuffle(names.begin(), names.end(), std::mt19937(0x2468));
+		enum : uint32_t { Lookups = 100000 };
+
+		float map = best_ms(10, [&]() {
+			uint32_t sum = 0;
+			for (uint32_t i = 0; i < Lookups; ++i) sum += buffer.meshes.find(names[i % names.size()])->second.start;
+			sink = float(sum);
+		});
+		float table = best_ms(10, [&]() {
+			uint32_t sum = 0;
+			for (uint32_t i = 0; i < Lookups; ++i) sum += buffer.lookup(names[i % names.size()]).start;
+			sink = float(sum);
+		});
+		for (auto const &name : names) {
+			if (&buffer.lookup(name) != &buffer.meshes.find(name)->second) {
+				std::cout << "  (lookup('" << name << "') found the wrong mesh)\n";
+				break;
+			}
+		}
+
+		float to_ns = 1e6f / float(Lookups);
+		std::cout << "  " << std::setw(8) << count << std::fixed << std::setprecision(1)
+		          << std::setw(10) << map * to_ns << std::setw(10) << table * to_ns << "\n";
+		std::cout.unsetf(std::ios::fixed);
+	}
+	std::remove(filename.c_str());
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	struct Section {
+		char const *name;
+		void (*run)();
+	};
+	std::vector< Section > sections = {
+		{ "transforms", bench_transforms },
+		{ "bvh", bench_bvh },
+		{ "lights", bench_lights },
+		{ "lz4", bench_lz4 },
+		{ "names", bench_names },
+	};
+
+	std::vector< std::string > picked(argv + 1, argv + argc);
+	for (auto const &name : picked) {
+		if (std::none_of(sections.begin(), sections.end(), [&name](Section const &s) { return name == s.name; })) {
+			std::cerr << "Usage:\n\t./bench [section ...]\nSections:";
+			for (auto const &s : sections) std::cerr << " " << s.name;
+			std::cerr << "\n(runs every section if none are given)" << std::endl;
+			return 1;
+		}
+	}
+	for (auto const &s : sections) {
+		if (picked.empty() || std::find(picked.begin(), picked.end(), s.name) != picked.end()) s.run();
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
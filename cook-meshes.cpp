@@ -0,0 +1,1172 @@
+//cook-meshes: offline processing for .pnct mesh files (as written by scenes/export-meshes.py).
+// Welds each mesh's duplicate vertices and writes an indexed file (ix16/ix32 + idx1 chunks; see Mesh.hpp),
+// so shared vertices are stored -- and shaded -- once.
+// Then (unless --no-optimize) reorders each mesh's triangles for the post-transform vertex cache (Tipsify),
+// orders the resulting triangle clusters to reduce overdraw, and reorders vertices for fetch locality.
+// With --quantize, writes the compact 20-byte vertex layout (pnq0 + bnd0 chunks; see Mesh.hpp) instead.
+// With --lods N, also generates N simplified levels of detail ("Name.lod1", ...) for each mesh (with a lod0 chunk of switch sizes).
+
+#include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
+#include "Meshlet.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+
+//(same layout as the vertices MeshBuffer reads)
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+//(same layout as the quantized vertices MeshBuffer reads)
+struct QuantizedVertex {
+	glm::u16vec3 Position; //fraction of the mesh's bounding box
+	uint16_t padding;
+	glm::i16vec2 NormalOct; //octahedral-encoded unit normal
+	glm::u8vec4 Color;
+	glm::u16vec2 TexCoord; //half floats
+};
+static_assert(sizeof(QuantizedVertex) == 3*2+2+2*2+4*1+2*2, "QuantizedVertex is packed.");
+
+//per-mesh bounding box (bnd0 chunk):
+struct Bounds {
+	glm::vec3 min, max;
+};
+static_assert(sizeof(Bounds) == 24, "Bounds should be packed");
+
+//-- quantization helpers --
+
+//IEEE half float conversion (round-to-nearest; out-of-range values become infinity):
+uint16_t float_to_half(float f) {
+	uint32_t x;
+	std::memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	int32_t exponent = int32_t((x >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = x & 0x7fffff;
+	if (((x >> 23) & 0xff) == 0xff) return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0)); //inf / nan
+	if (exponent >= 31) return uint16_t(sign | 0x7c00);
+	if (exponent <= 0) {
+		//subnormal (or zero):
+		if (exponent < -10) return uint16_t(sign);
+		mantissa |= 0x800000;
+		uint32_t shift = uint32_t(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) half += 1;
+		return uint16_t(sign | half);
+	}
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half += 1; //(a carry into the exponent is still correct)
+	return uint16_t(half);
+}
+
+float half_to_float(uint16_t h) {
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	uint32_t x;
+	if (exponent == 0x1f) {
+		x = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	} else if (mantissa == 0) {
+		x = sign;
+	} else {
+		//subnormal -> normalize:
+		exponent = 127 - 15 + 1;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent -= 1;
+		}
+		x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	}
+	float f;
+	std::memcpy(&f, &x, 4);
+	return f;
+}
+
+//octahedral normal encoding (Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors", 2014):
+glm::i16vec2 oct_encode(glm::vec3 n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (l1 == 0.0f) return glm::i16vec2(0);
+	glm::vec2 e = glm::vec2(n.x, n.y) / l1;
+	if (n.z < 0.0f) {
+		e = glm::vec2(
+			(1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f)
+		);
+	}
+	auto snorm = [](float v) {
+		return int16_t(std::round(std::max(-1.0f, std::min(1.0f, v)) * 32767.0f));
+	};
+	return glm::i16vec2(snorm(e.x), snorm(e.y));
+}
+
+glm::vec3 oct_decode(glm::i16vec2 q) {
+	glm::vec2 e(std::max(-1.0f, q.x / 32767.0f), std::max(-1.0f, q.y / 32767.0f));
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	if (n.z < 0.0f) {
+		n.x = (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	float length = std::sqrt(n.x*n.x + n.y*n.y + n.z*n.z);
+	return n / length;
+}
+
+QuantizedVertex quantize_vertex(Vertex const &v, Bounds const &bounds) {
+	QuantizedVertex q;
+	for (uint32_t c = 0; c < 3; ++c) {
+		float size = bounds.max[c] - bounds.min[c];
+		float t = (size > 0.0f ? (v.Position[c] - bounds.min[c]) / size : 0.0f);
+		q.Position[c] = uint16_t(std::round(std::max(0.0f, std::min(1.0f, t)) * 65535.0f));
+	}
+	q.padding = 0;
+	q.NormalOct = oct_encode(v.Normal);
+	q.Color = v.Color;
+	q.TexCoord = glm::u16vec2(float_to_half(v.TexCoord.x), float_to_half(v.TexCoord.y));
+	return q;
+}
+
+Vertex dequantize_vertex(QuantizedVertex const &q, Bounds const &bounds) {
+	Vertex v;
+	for (uint32_t c = 0; c < 3; ++c) {
+		v.Position[c] = bounds.min[c] + (q.Position[c] / 65535.0f) * (bounds.max[c] - bounds.min[c]);
+	}
+	v.Normal = oct_decode(q.NormalOct);
+	v.Color = q.Color;
+	v.TexCoord = glm::vec2(half_to_float(q.TexCoord.x), half_to_float(q.TexCoord.y));
+	return v;
+}
+
+//a mesh being cooked: its own vertices, plus triangle-list indices into them:
+struct CookMesh {
+	std::string name;
+	std::vector< Vertex > vertices;
+	std::vector< uint32_t > indices;
+	float lod_size = 0.0f; //(levels of detail only) projected size below which this level is drawn; see Mesh::LOD
+	std::vector< Meshlet > meshlets; //(optional) with element index ranges relative to 'indices'
+};
+
+//is this the name of a level of detail ("<name>.lodN")?
+bool is_lod_name(std::string const &name) {
+	size_t suffix = name.rfind(".lod");
+	return suffix != std::string::npos && suffix + 4 < name.size()
+	    && name.find_first_not_of("0123456789", suffix + 4) == std::string::npos;
+}
+
+//read every mesh in a .pnct file (indexed or not; quantized files are converted back to float vertices):
+std::vector< CookMesh > read_meshes(std::string const &filename) {
+	MappedFile file(filename);
+	ChunkReader reader(file.data(), file.data() + file.size());
+	reader.verify_checksums = true; //(cooking is offline, so it is worth catching corrupt files here)
+
+	ChunkView< Vertex > data;
+	ChunkView< QuantizedVertex > quantized;
+	if (reader.next_chunk_is("pnq0")) {
+		quantized = reader.read_chunk< QuantizedVertex >("pnq0");
+	} else {
+		data = reader.read_chunk< Vertex >("pnct");
+	}
+	size_t vertex_count = data.size() + quantized.size();
+	std::vector< uint32_t > indices;
+	bool indexed = false;
+	if (reader.next_chunk_is("ix16")) {
+		ChunkView< uint16_t > ix16 = reader.read_chunk< uint16_t >("ix16");
+		indices.assign(ix16.begin(), ix16.end());
+		indexed = true;
+	} else if (reader.next_chunk_is("ix32")) {
+		ChunkView< uint32_t > ix32 = reader.read_chunk< uint32_t >("ix32");
+		indices.assign(ix32.begin(), ix32.end());
+		indexed = true;
+	}
+
+	ChunkView< char > strings = reader.read_chunk< char >("str0");
+
+	struct IndexEntry {
+		uint32_t name_begin, name_end;
+		uint32_t vertex_begin, vertex_end;
+		uint32_t index_begin, index_end;
+	};
+	static_assert(sizeof(IndexEntry) == 24, "Index entry should be packed");
+	struct IndexEntry0 {
+		uint32_t name_begin, name_end;
+		uint32_t vertex_begin, vertex_end;
+	};
+	static_assert(sizeof(IndexEntry0) == 16, "Index entry should be packed");
+
+	std::vector< IndexEntry > index;
+	if (!indexed) {
+		ChunkView< IndexEntry0 > index0 = reader.read_chunk< IndexEntry0 >("idx0");
+		for (auto const &entry : index0) {
+			index.emplace_back(IndexEntry{entry.name_begin, entry.name_end, entry.vertex_begin, entry.vertex_end, 0, 0});
+		}
+	} else {
+		ChunkView< IndexEntry > index1 = reader.read_chunk< IndexEntry >("idx1");
+		index.assign(index1.begin(), index1.end());
+	}
+
+	ChunkView< Bounds > bounds;
+	if (!quantized.empty()) {
+		bounds = reader.read_chunk< Bounds >("bnd0");
+		if (bounds.size() != index.size()) throw std::runtime_error("bounds chunk doesn't match index chunk");
+	}
+
+	ChunkView< float > lod_sizes;
+	if (reader.next_chunk_is("lod0")) {
+		lod_sizes = reader.read_chunk< float >("lod0");
+		if (lod_sizes.size() != index.size()) throw std::runtime_error("lod chunk doesn't match index chunk");
+	}
+
+	std::vector< CookMesh > meshes;
+	for (auto const &entry : index) {
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			throw std::runtime_error("index entry has out-of-range name begin/end");
+		}
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= vertex_count)) {
+			throw std::runtime_error("index entry has out-of-range vertex start/count");
+		}
+		if (!(entry.index_begin <= entry.index_end && entry.index_end <= indices.size())) {
+			throw std::runtime_error("index entry has out-of-range element index start/count");
+		}
+		meshes.emplace_back();
+		CookMesh &mesh = meshes.back();
+		mesh.name = std::string(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+		if (!lod_sizes.empty()) mesh.lod_size = lod_sizes[&entry - &index[0]];
+		if (quantized.empty()) {
+			mesh.vertices.assign(data.begin() + entry.vertex_begin, data.begin() + entry.vertex_end);
+		} else {
+			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+				mesh.vertices.emplace_back(dequantize_vertex(quantized[v], bounds[&entry - &index[0]]));
+			}
+		}
+		if (indexed) {
+			mesh.indices.assign(indices.begin() + entry.index_begin, indices.begin() + entry.index_end);
+			for (uint32_t i : mesh.indices) {
+				if (i >= mesh.vertices.size()) throw std::runtime_error("mesh '" + mesh.name + "' has an element index outside of its vertices");
+			}
+		} else {
+			for (uint32_t i = 0; i < mesh.vertices.size(); ++i) {
+				mesh.indices.emplace_back(i);
+			}
+		}
+	}
+
+	return meshes;
+}
+
+//merge bit-for-bit identical vertices (and drop any vertices no index refers to):
+void weld(CookMesh *mesh_) {
+	assert(mesh_);
+	CookMesh &mesh = *mesh_;
+
+	struct VertexHash {
+		size_t operator()(Vertex const &v) const {
+			//FNV-1a over the vertex bytes:
+			uint8_t const *bytes = reinterpret_cast< uint8_t const * >(&v);
+			uint64_t h = 14695981039346656037ULL;
+			for (size_t i = 0; i < sizeof(Vertex); ++i) {
+				h = (h ^ bytes[i]) * 1099511628211ULL;
+			}
+			return size_t(h);
+		}
+	};
+	struct VertexEqual {
+		bool operator()(Vertex const &a, Vertex const &b) const {
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	std::unordered_map< Vertex, uint32_t, VertexHash, VertexEqual > welded_index;
+	welded_index.reserve(mesh.vertices.size());
+	std::vector< Vertex > welded;
+	for (uint32_t &i : mesh.indices) {
+		auto ret = welded_index.emplace(mesh.vertices[i], uint32_t(welded.size()));
+		if (ret.second) welded.emplace_back(mesh.vertices[i]);
+		i = ret.first->second;
+	}
+	mesh.vertices = std::move(welded);
+}
+
+//-- vertex cache optimization --
+// (see Sander, Nehab, and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007)
+
+//size of the simulated FIFO post-transform cache (used both when optimizing and when measuring):
+enum : uint32_t { CacheSize = 16 };
+
+//cache misses per triangle (ACMR) and per vertex (ATVR) when drawing a mesh through a FIFO cache:
+// (ACMR is at best ~0.5 for large regular meshes; ATVR is at best 1.0)
+struct CacheStats {
+	float acmr = 0.0f;
+	float atvr = 0.0f;
+};
+CacheStats measure_cache(CookMesh const &mesh) {
+	std::vector< uint32_t > stamp(mesh.vertices.size(), 0); //'misses' count when vertex entered the cache (0 => never)
+	uint32_t misses = 0;
+	for (uint32_t i : mesh.indices) {
+		if (stamp[i] == 0 || misses - stamp[i] >= CacheSize) {
+			misses += 1;
+			stamp[i] = misses;
+		}
+	}
+	CacheStats stats;
+	if (!mesh.indices.empty()) stats.acmr = float(misses) / float(mesh.indices.size() / 3);
+	if (!mesh.vertices.empty()) stats.atvr = float(misses) / float(mesh.vertices.size());
+	return stats;
+}
+
+//reorder triangles for vertex cache locality with Tipsify:
+// returns the index of the first triangle of each cluster (places where the walk jumped to a new area)
+std::vector< uint32_t > tipsify(CookMesh *mesh_) {
+	assert(mesh_);
+	CookMesh &mesh = *mesh_;
+	uint32_t vertex_count = uint32_t(mesh.vertices.size());
+	uint32_t triangle_count = uint32_t(mesh.indices.size() / 3);
+
+	//vertex -> triangle adjacency:
+	std::vector< uint32_t > live(vertex_count, 0); //triangles not yet emitted that use each vertex
+	for (uint32_t i : mesh.indices) live[i] += 1;
+	std::vector< uint32_t > adjacency_begin(vertex_count + 1, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v) adjacency_begin[v + 1] = adjacency_begin[v] + live[v];
+	std::vector< uint32_t > adjacency(mesh.indices.size());
+	{
+		std::vector< uint32_t > fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				adjacency[fill[mesh.indices[3*t+c]]++] = t;
+			}
+		}
+	}
+
+	std::vector< uint32_t > cache_time(vertex_count, 0); //time each vertex entered the cache
+	std::vector< bool > emitted(triangle_count, false);
+	std::vector< uint32_t > dead_end; //recently-used vertices, to restart from
+	std::vector< uint32_t > candidates;
+	std::vector< uint32_t > out;
+	out.reserve(mesh.indices.size());
+	std::vector< uint32_t > clusters;
+
+	uint32_t time = CacheSize + 1;
+	uint32_t cursor = 0; //for the (rare) case where the dead-end stack has nothing live
+	uint32_t fan = (vertex_count ? 0 : -1U);
+	if (triangle_count) clusters.emplace_back(0);
+	while (fan != -1U) {
+		//emit every remaining triangle around the fanning vertex:
+		candidates.clear();
+		for (uint32_t a = adjacency_begin[fan]; a < adjacency_begin[fan + 1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+			emitted[t] = true;
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t v = mesh.indices[3*t+c];
+				out.emplace_back(v);
+				dead_end.emplace_back(v);
+				candidates.emplace_back(v);
+				live[v] -= 1;
+				if (time - cache_time[v] > CacheSize) {
+					cache_time[v] = time;
+					time += 1;
+				}
+			}
+		}
+
+		//next fanning vertex: the candidate that will stay in the cache longest after its remaining triangles are emitted:
+		uint32_t next = -1U;
+		int32_t best = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) continue;
+			int32_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= CacheSize) priority = int32_t(time - cache_time[v]);
+			if (priority > best) {
+				best = priority;
+				next = v;
+			}
+		}
+		if (next == -1U) {
+			//dead end -- restart from a recently-used vertex, or failing that any vertex with triangles left:
+			while (!dead_end.empty() && next == -1U) {
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0) next = v;
+			}
+			while (cursor < vertex_count && next == -1U) {
+				if (live[cursor] > 0) next = cursor;
+				++cursor;
+			}
+			if (next != -1U && out.size() / 3 < triangle_count) clusters.emplace_back(uint32_t(out.size() / 3));
+		}
+		fan = next;
+	}
+	assert(out.size() == mesh.indices.size());
+	mesh.indices = std::move(out);
+	return clusters;
+}
+
+//draw clusters that face away from the mesh's center first, since they tend to occlude the rest:
+// (only kept if it doesn't cost much vertex cache efficiency)
+void reduce_overdraw(CookMesh *mesh_, std::vector< uint32_t > const &clusters) {
+	assert(mesh_);
+	CookMesh &mesh = *mesh_;
+	if (clusters.size() < 2) return;
+	uint32_t triangle_count = uint32_t(mesh.indices.size() / 3);
+
+	auto position = [&](uint32_t t, uint32_t c) {
+		return mesh.vertices[mesh.indices[3*t+c]].Position;
+	};
+
+	//area-weighted mesh center:
+	glm::vec3 center(0.0f);
+	float total_area = 0.0f;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		float area = 0.5f * glm::length(glm::cross(position(t,1) - position(t,0), position(t,2) - position(t,0)));
+		center += area * (position(t,0) + position(t,1) + position(t,2)) / 3.0f;
+		total_area += area;
+	}
+	if (total_area == 0.0f) return;
+	center /= total_area;
+
+	struct Cluster {
+		uint32_t begin, end; //triangles
+		float outward; //how much the cluster faces away from the center
+	};
+	std::vector< Cluster > sorted;
+	for (uint32_t c = 0; c < clusters.size(); ++c) {
+		Cluster cluster;
+		cluster.begin = clusters[c];
+		cluster.end = (c + 1 < clusters.size() ? clusters[c + 1] : triangle_count);
+		glm::vec3 cluster_center(0.0f);
+		glm::vec3 normal(0.0f); //(area-weighted, since the cross product's length is twice the area)
+		float area = 0.0f;
+		for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+			glm::vec3 n = glm::cross(position(t,1) - position(t,0), position(t,2) - position(t,0));
+			float a = 0.5f * glm::length(n);
+			cluster_center += a * (position(t,0) + position(t,1) + position(t,2)) / 3.0f;
+			normal += n;
+			area += a;
+		}
+		if (area > 0.0f) cluster_center /= area;
+		float length = glm::length(normal);
+		cluster.outward = (length > 0.0f ? glm::dot(cluster_center - center, normal / length) : 0.0f);
+		sorted.emplace_back(cluster);
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const &a, Cluster const &b) {
+		return a.outward > b.outward;
+	});
+
+	CookMesh reordered;
+	reordered.vertices = mesh.vertices;
+	reordered.indices.reserve(mesh.indices.size());
+	for (auto const &cluster : sorted) {
+		reordered.indices.insert(reordered.indices.end(), mesh.indices.begin() + 3 * cluster.begin, mesh.indices.begin() + 3 * cluster.end);
+	}
+	if (measure_cache(reordered).acmr <= 1.05f * measure_cache(mesh).acmr) {
+		mesh.indices = std::move(reordered.indices);
+	}
+}
+
+//renumber vertices in the order they are first used, so vertex fetches walk forward through memory:
+void optimize_fetch(CookMesh *mesh_) {
+	assert(mesh_);
+	CookMesh &mesh = *mesh_;
+	std::vector< uint32_t > remap(mesh.vertices.size(), -1U);
+	std::vector< Vertex > vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t &i : mesh.indices) {
+		if (remap[i] == -1U) {
+			remap[i] = uint32_t(vertices.size());
+			vertices.emplace_back(mesh.vertices[i]);
+		}
+		i = remap[i];
+	}
+	mesh.vertices = std::move(vertices);
+}
+
+//number the distinct vertex positions in a mesh ('points'), so vertices that differ only in attributes can be treated as one:
+void find_points(CookMesh const &mesh, std::vector< uint32_t > *point_of_, std::vector< glm::vec3 > *points_) {
+	assert(point_of_);
+	assert(points_);
+	std::vector< uint32_t > &point_of = *point_of_;
+	std::vector< glm::vec3 > &points = *points_;
+	uint32_t vertex_count = uint32_t(mesh.vertices.size());
+
+	std::vector< uint32_t > order(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) order[v] = v;
+	auto less = [&](uint32_t a, uint32_t b) {
+		glm::vec3 const &pa = mesh.vertices[a].Position;
+		glm::vec3 const &pb = mesh.vertices[b].Position;
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		return pa.z < pb.z;
+	};
+	std::sort(order.begin(), order.end(), less);
+	point_of.assign(vertex_count, 0);
+	points.clear();
+	for (uint32_t i = 0; i < vertex_count; ++i) {
+		if (i == 0 || less(order[i-1], order[i])) points.emplace_back(mesh.vertices[order[i]].Position);
+		point_of[order[i]] = uint32_t(points.size() - 1);
+	}
+}
+
+//-- simplification (for levels of detail) --
+// (edge collapses ordered by quadric error: Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997)
+// Vertices are only ever collapsed onto neighboring vertices, so every level uses a subset of the original vertices.
+// Vertices at the same position but with different attributes (seams) collapse together, and only along the seam;
+// open borders and seams are held in place by extra planes through their edges.
+// Faceted meshes (no vertex shared between triangles, as with flat shading) are all seams, so they are simplified by
+// position alone instead: triangles keep their own colors and texture coordinates and get new face normals.
+
+//sum of squared distances to a set of planes, as a symmetric 4x4 matrix:
+struct Quadric {
+	double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0;
+	double yy = 0.0, yz = 0.0, yw = 0.0;
+	double zz = 0.0, zw = 0.0;
+	double ww = 0.0;
+
+	//add the plane dot(n, p) + d = 0 (n unit length):
+	void add_plane(glm::vec3 const &n, float d, double weight) {
+		xx += weight * n.x * n.x; xy += weight * n.x * n.y; xz += weight * n.x * n.z; xw += weight * n.x * d;
+		yy += weight * n.y * n.y; yz += weight * n.y * n.z; yw += weight * n.y * d;
+		zz += weight * n.z * n.z; zw += weight * n.z * d;
+		ww += weight * double(d) * d;
+	}
+	void add(Quadric const &o) {
+		xx += o.xx; xy += o.xy; xz += o.xz; xw += o.xw;
+		yy += o.yy; yz += o.yz; yw += o.yw;
+		zz += o.zz; zw += o.zw;
+		ww += o.ww;
+	}
+	double error(glm::vec3 const &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = xx*x*x + 2.0*xy*x*y + 2.0*xz*x*z + 2.0*xw*x
+		         + yy*y*y + 2.0*yz*y*z + 2.0*yw*y
+		         + zz*z*z + 2.0*zw*z
+		         + ww;
+		return std::max(0.0, e);
+	}
+};
+
+//simplify a (welded) triangle mesh down to about 'target' triangles:
+// sets *error_ to an estimate of the largest distance (in mesh units) between the result and the original surface
+CookMesh simplify(CookMesh const &mesh, uint32_t target, float *error_) {
+	enum : uint32_t { BorderWeight = 10 }; //how strongly open borders and seams are kept in place
+
+	uint32_t vertex_count = uint32_t(mesh.vertices.size());
+	uint32_t triangle_count = uint32_t(mesh.indices.size() / 3);
+
+	//vertices at the same position share a 'point':
+	std::vector< uint32_t > point_of;
+	std::vector< glm::vec3 > points;
+	find_points(mesh, &point_of, &points);
+	uint32_t point_count = uint32_t(points.size());
+
+	//faceted mesh?
+	bool faceted = true;
+	{
+		std::vector< bool > used(vertex_count, false);
+		for (uint32_t i : mesh.indices) {
+			if (used[i]) faceted = false;
+			used[i] = true;
+		}
+	}
+
+	std::vector< uint32_t > corners = mesh.indices; //triangle corners (as vertices; updated by collapses, except when faceted)
+	std::vector< uint32_t > corner_points(corners.size()); //..and as points
+	for (uint32_t i = 0; i < corners.size(); ++i) corner_points[i] = point_of[corners[i]];
+	std::vector< bool > triangle_alive(triangle_count, true);
+	auto corner_point = [&](uint32_t t, uint32_t c) {
+		return corner_points[3*t+c];
+	};
+
+	//triangles around each point (may include dead triangles, which are skipped):
+	std::vector< std::vector< uint32_t > > point_triangles(point_count);
+	uint32_t alive = 0;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		uint32_t a = corner_point(t,0), b = corner_point(t,1), c = corner_point(t,2);
+		if (a == b || b == c || c == a) {
+			triangle_alive[t] = false; //(degenerate to begin with)
+			continue;
+		}
+		alive += 1;
+		for (uint32_t p : {a, b, c}) point_triangles[p].emplace_back(t);
+	}
+
+	//vertices (i.e., attribute variants) at each point:
+	std::vector< std::vector< uint32_t > > point_vertices(point_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		point_vertices[point_of[v]].emplace_back(v);
+	}
+
+	//quadrics: the plane of every triangle, plus planes perpendicular to border and seam edges:
+	std::vector< Quadric > quadrics(point_count);
+	{
+		//(edges are between vertices, or for faceted meshes between points)
+		std::vector< uint32_t > const &ends = (faceted ? corner_points : corners);
+		std::unordered_map< uint64_t, uint32_t > half_edges; //(from << 32 | to) -> count
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (!triangle_alive[t]) continue;
+			for (uint32_t c = 0; c < 3; ++c) {
+				half_edges[(uint64_t(ends[3*t+c]) << 32) | ends[3*t+(c+1)%3]] += 1;
+			}
+		}
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (!triangle_alive[t]) continue;
+			glm::vec3 const &a = points[corner_point(t,0)];
+			glm::vec3 const &b = points[corner_point(t,1)];
+			glm::vec3 const &c = points[corner_point(t,2)];
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float length = glm::length(n);
+			if (length == 0.0f) continue;
+			n /= length;
+			Quadric q;
+			q.add_plane(n, -glm::dot(n, a), 1.0);
+			for (uint32_t i = 0; i < 3; ++i) quadrics[corner_point(t,i)].add(q);
+
+			for (uint32_t i = 0; i < 3; ++i) {
+				uint32_t from = ends[3*t+i], to = ends[3*t+(i+1)%3];
+				if (half_edges.count((uint64_t(to) << 32) | from)) continue; //(interior edge)
+				uint32_t from_point = corner_point(t,i), to_point = corner_point(t,(i+1)%3);
+				glm::vec3 const &p0 = points[from_point];
+				glm::vec3 const &p1 = points[to_point];
+				glm::vec3 edge_n = glm::cross(p1 - p0, n);
+				float edge_length = glm::length(edge_n);
+				if (edge_length == 0.0f) continue;
+				edge_n /= edge_length;
+				Quadric border;
+				border.add_plane(edge_n, -glm::dot(edge_n, p0), BorderWeight);
+				quadrics[from_point].add(border);
+				quadrics[to_point].add(border);
+			}
+		}
+	}
+
+	//candidate collapses, cheapest first; entries are stale if either point changed since they were pushed:
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t from_version, to_version;
+		bool operator<(Collapse const &o) const { return cost > o.cost; }
+	};
+	std::priority_queue< Collapse > queue;
+	std::vector< uint32_t > version(point_count, 0);
+	std::vector< bool > point_alive(point_count, true);
+
+	auto push_collapses = [&](uint32_t p) {
+		for (uint32_t t : point_triangles[p]) {
+			if (!triangle_alive[t]) continue;
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t q = corner_point(t,c);
+				if (q == p) continue;
+				Quadric sum = quadrics[p];
+				sum.add(quadrics[q]);
+				queue.push(Collapse{sum.error(points[q]), p, q, version[p], version[q]});
+				queue.push(Collapse{sum.error(points[p]), q, p, version[q], version[p]});
+			}
+		}
+	};
+	for (uint32_t p = 0; p < point_count; ++p) push_collapses(p);
+
+	double max_cost = 0.0;
+	std::vector< std::pair< uint32_t, uint32_t > > vertex_map; //(from vertex, to vertex) for a collapse
+	std::vector< uint32_t > neighbors;
+	while (alive > target && !queue.empty()) {
+		Collapse collapse = queue.top();
+		queue.pop();
+		uint32_t u = collapse.from, v = collapse.to;
+		if (!point_alive[u] || !point_alive[v]) continue;
+		if (collapse.from_version != version[u] || collapse.to_version != version[v]) continue;
+
+		//every vertex at u must share triangles with exactly one vertex at v (which it will become):
+		// (faceted meshes' triangles keep their own vertices, so don't need this)
+		vertex_map.clear();
+		bool ok = true;
+		for (uint32_t a : point_vertices[u]) {
+			if (faceted) break;
+			uint32_t b = -1U;
+			for (uint32_t t : point_triangles[u]) {
+				if (!triangle_alive[t]) continue;
+				bool has_a = false;
+				uint32_t at_v = -1U;
+				for (uint32_t c = 0; c < 3; ++c) {
+					if (corners[3*t+c] == a) has_a = true;
+					if (corner_point(t,c) == v) at_v = corners[3*t+c];
+				}
+				if (!has_a || at_v == -1U) continue;
+				if (b != -1U && b != at_v) ok = false;
+				b = at_v;
+			}
+			if (b == -1U) ok = false;
+			if (!ok) break;
+			vertex_map.emplace_back(a, b);
+		}
+		if (!ok) continue;
+
+		//topology: the only points adjacent to both u and v should be the third corners of triangles on edge uv
+		// (otherwise the collapse would pinch the surface):
+		uint32_t shared_triangles = 0;
+		neighbors.clear();
+		for (uint32_t t : point_triangles[u]) {
+			if (!triangle_alive[t]) continue;
+			bool has_v = false;
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (corner_point(t,c) == v) has_v = true;
+				else if (corner_point(t,c) != u) neighbors.emplace_back(corner_point(t,c));
+			}
+			if (has_v) shared_triangles += 1;
+		}
+		std::sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+		uint32_t shared_neighbors = 0;
+		for (uint32_t n : neighbors) {
+			for (uint32_t t : point_triangles[v]) {
+				if (!triangle_alive[t]) continue;
+				if (corner_point(t,0) == n || corner_point(t,1) == n || corner_point(t,2) == n) {
+					shared_neighbors += 1;
+					break;
+				}
+			}
+		}
+		if (shared_neighbors != shared_triangles) continue;
+
+		//geometry: no triangle that survives may flip over:
+		for (uint32_t t : point_triangles[u]) {
+			if (!triangle_alive[t]) continue;
+			glm::vec3 before[3], after[3];
+			bool has_v = false;
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t p = corner_point(t,c);
+				if (p == v) has_v = true;
+				before[c] = points[p];
+				after[c] = (p == u ? points[v] : points[p]);
+			}
+			if (has_v) continue;
+			glm::vec3 n_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 n_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(n_before, n_after) <= 0.0f) {
+				ok = false;
+				break;
+			}
+		}
+		if (!ok) continue;
+
+		//collapse u onto v:
+		for (uint32_t t : point_triangles[u]) {
+			if (!triangle_alive[t]) continue;
+			if (corner_point(t,0) == v || corner_point(t,1) == v || corner_point(t,2) == v) {
+				triangle_alive[t] = false;
+				alive -= 1;
+				continue;
+			}
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (corner_points[3*t+c] == u) corner_points[3*t+c] = v;
+				for (auto const &ab : vertex_map) {
+					if (corners[3*t+c] == ab.first) corners[3*t+c] = ab.second;
+				}
+			}
+			point_triangles[v].emplace_back(t);
+		}
+		point_triangles[u].clear();
+		point_vertices[u].clear();
+		point_alive[u] = false;
+		quadrics[v].add(quadrics[u]);
+		max_cost = std::max(max_cost, collapse.cost);
+
+		//drop dead triangles from v's list and queue its (re-priced) collapses:
+		std::vector< uint32_t > &around = point_triangles[v];
+		around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t){ return !triangle_alive[t]; }), around.end());
+		version[v] += 1;
+		push_collapses(v);
+	}
+
+	CookMesh simplified;
+	simplified.name = mesh.name;
+	if (faceted) {
+		//new vertices for each remaining triangle (with the triangle's new normal):
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (!triangle_alive[t]) continue;
+			glm::vec3 const &a = points[corner_point(t,0)];
+			glm::vec3 n = glm::cross(points[corner_point(t,1)] - a, points[corner_point(t,2)] - a);
+			float length = glm::length(n);
+			for (uint32_t c = 0; c < 3; ++c) {
+				Vertex vertex = mesh.vertices[corners[3*t+c]];
+				vertex.Position = points[corner_point(t,c)];
+				if (length > 0.0f) vertex.Normal = n / length;
+				simplified.indices.emplace_back(uint32_t(simplified.vertices.size()));
+				simplified.vertices.emplace_back(vertex);
+			}
+		}
+		weld(&simplified);
+	} else {
+		simplified.vertices = mesh.vertices;
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (!triangle_alive[t]) continue;
+			simplified.indices.insert(simplified.indices.end(), corners.begin() + 3*t, corners.begin() + 3*t + 3);
+		}
+	}
+	optimize_fetch(&simplified); //(drops the vertices that are no longer used)
+
+	if (error_) *error_ = float(std::sqrt(max_cost));
+	return simplified;
+}
+
+//-- meshlets --
+// (see Meshlet.hpp)
+
+enum : uint32_t { MaxMeshletTriangles = 128 };
+
+//bounding sphere and normal cone of the triangles [begin,end) of a mesh:
+Meshlet meshlet_bounds(CookMesh const &mesh, uint32_t begin, uint32_t end) {
+	Meshlet meshlet;
+	meshlet.index_begin = 3 * begin;
+	meshlet.index_end = 3 * end;
+
+	auto position = [&](uint32_t t, uint32_t c) {
+		return mesh.vertices[mesh.indices[3*t+c]].Position;
+	};
+
+	glm::vec3 min = position(begin,0), max = position(begin,0);
+	for (uint32_t t = begin; t < end; ++t) {
+		for (uint32_t c = 0; c < 3; ++c) {
+			min = glm::min(min, position(t,c));
+			max = glm::max(max, position(t,c));
+		}
+	}
+	meshlet.center = 0.5f * (min + max);
+	meshlet.radius = 0.0f;
+	for (uint32_t t = begin; t < end; ++t) {
+		for (uint32_t c = 0; c < 3; ++c) {
+			meshlet.radius = std::max(meshlet.radius, glm::length(position(t,c) - meshlet.center));
+		}
+	}
+
+	//cone axis is the average normal; cone half-angle reaches the normal furthest from it:
+	std::vector< glm::vec3 > normals;
+	glm::vec3 sum = glm::vec3(0.0f);
+	for (uint32_t t = begin; t < end; ++t) {
+		glm::vec3 n = glm::cross(position(t,1) - position(t,0), position(t,2) - position(t,0));
+		float length = glm::length(n);
+		if (length == 0.0f) continue;
+		normals.emplace_back(n / length);
+		sum += normals.back();
+	}
+	float length = glm::length(sum);
+	meshlet.cone_axis = (length > 1e-6f ? sum / length : glm::vec3(0.0f, 0.0f, 1.0f));
+	meshlet.cone_cutoff = 1.0f;
+	if (length > 1e-6f) {
+		float min_dot = 1.0f;
+		for (auto const &n : normals) min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+		if (min_dot > 0.0f) meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+	}
+	return meshlet;
+}
+
+//split a mesh's triangles into meshlets of up to MaxMeshletTriangles nearby, similarly-facing triangles,
+// reordering triangles so each meshlet's are contiguous (they otherwise keep their order):
+void build_meshlets(CookMesh *mesh_) {
+	assert(mesh_);
+	CookMesh &mesh = *mesh_;
+	uint32_t triangle_count = uint32_t(mesh.indices.size() / 3);
+	mesh.meshlets.clear();
+	if (triangle_count == 0) return;
+
+	//triangles are neighbors if they share a corner position (so faceted meshes still connect):
+	std::vector< uint32_t > point_of;
+	std::vector< glm::vec3 > points;
+	find_points(mesh, &point_of, &points);
+	std::vector< uint32_t > adjacency_begin(points.size() + 1, 0);
+	for (uint32_t i : mesh.indices) adjacency_begin[point_of[i] + 1] += 1;
+	for (uint32_t p = 0; p < points.size(); ++p) adjacency_begin[p + 1] += adjacency_begin[p];
+	std::vector< uint32_t > adjacency(mesh.indices.size());
+	{
+		std::vector< uint32_t > fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+		for (uint32_t i = 0; i < mesh.indices.size(); ++i) {
+			adjacency[fill[point_of[mesh.indices[i]]]++] = i / 3;
+		}
+	}
+
+	std::vector< glm::vec3 > centers(triangle_count);
+	std::vector< glm::vec3 > normals(triangle_count);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		glm::vec3 const &a = points[point_of[mesh.indices[3*t+0]]];
+		glm::vec3 const &b = points[point_of[mesh.indices[3*t+1]]];
+		glm::vec3 const &c = points[point_of[mesh.indices[3*t+2]]];
+		centers[t] = (a + b + c) / 3.0f;
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		normals[t] = (length > 0.0f ? n / length : glm::vec3(0.0f));
+	}
+
+	//grow each meshlet outward from the first unused triangle, nearest triangles first,
+	// skipping triangles that face too far from the first (to keep normal cones narrow):
+	std::vector< bool > used(triangle_count, false);
+	std::vector< uint32_t > order;
+	order.reserve(triangle_count);
+	std::vector< uint32_t > meshlet;
+	typedef std::pair< float, uint32_t > Candidate; //(distance, triangle)
+	std::priority_queue< Candidate, std::vector< Candidate >, std::greater< Candidate > > candidates;
+	for (uint32_t seed = 0; seed < triangle_count; ++seed) {
+		if (used[seed]) continue;
+		meshlet.clear();
+		candidates = decltype(candidates)();
+		candidates.emplace(0.0f, seed);
+		while (!candidates.empty() && meshlet.size() < MaxMeshletTriangles) {
+			uint32_t t = candidates.top().second;
+			candidates.pop();
+			if (used[t]) continue;
+			if (t != seed && glm::dot(normals[t], normals[seed]) < 0.25f && normals[seed] != glm::vec3(0.0f)) continue;
+			used[t] = true;
+			meshlet.emplace_back(t);
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t p = point_of[mesh.indices[3*t+c]];
+				for (uint32_t a = adjacency_begin[p]; a < adjacency_begin[p+1]; ++a) {
+					uint32_t n = adjacency[a];
+					if (!used[n]) candidates.emplace(glm::length(centers[n] - centers[seed]), n);
+				}
+			}
+		}
+		std::sort(meshlet.begin(), meshlet.end());
+		uint32_t begin = uint32_t(order.size());
+		order.insert(order.end(), meshlet.begin(), meshlet.end());
+		mesh.meshlets.emplace_back(Meshlet{begin, uint32_t(order.size()), glm::vec3(0.0f), 0.0f, glm::vec3(0.0f), 0.0f});
+	}
+
+	std::vector< uint32_t > indices;
+	indices.reserve(mesh.indices.size());
+	for (uint32_t t : order) {
+		indices.insert(indices.end(), mesh.indices.begin() + 3*t, mesh.indices.begin() + 3*t + 3);
+	}
+	mesh.indices = std::move(indices);
+	for (auto &m : mesh.meshlets) {
+		m = meshlet_bounds(mesh, m.index_begin, m.index_end);
+	}
+}
+
+//write meshes as an indexed .pnct file (with quantized vertices if 'quantize'):
+void write_meshes(std::vector< CookMesh > const &meshes, std::string const &filename, bool compress, bool quantize) {
+	std::vector< Vertex > data;
+	std::vector< QuantizedVertex > quantized;
+	std::vector< Bounds > bounds;
+	std::vector< uint32_t > indices;
+	std::vector< char > strings;
+	struct IndexEntry {
+		uint32_t name_begin, name_end;
+		uint32_t vertex_begin, vertex_end;
+		uint32_t index_begin, index_end;
+	};
+	std::vector< IndexEntry > index;
+	std::vector< float > lod_sizes;
+	bool has_lods = false;
+	std::vector< Meshlet > meshlets;
+
+	bool small = true; //can every index fit in 16 bits?
+	for (auto const &mesh : meshes) {
+		IndexEntry entry;
+		entry.name_begin = uint32_t(strings.size());
+		strings.insert(strings.end(), mesh.name.begin(), mesh.name.end());
+		entry.name_end = uint32_t(strings.size());
+		if (quantize) {
+			Bounds b;
+			b.min = glm::vec3( std::numeric_limits< float >::infinity());
+			b.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (auto const &v : mesh.vertices) {
+				b.min = glm::min(b.min, v.Position);
+				b.max = glm::max(b.max, v.Position);
+			}
+			if (mesh.vertices.empty()) b.min = b.max = glm::vec3(0.0f);
+			bounds.emplace_back(b);
+			entry.vertex_begin = uint32_t(quantized.size());
+			for (auto const &v : mesh.vertices) {
+				quantized.emplace_back(quantize_vertex(v, b));
+			}
+			entry.vertex_end = uint32_t(quantized.size());
+		} else {
+			entry.vertex_begin = uint32_t(data.size());
+			data.insert(data.end(), mesh.vertices.begin(), mesh.vertices.end());
+			entry.vertex_end = uint32_t(data.size());
+		}
+		entry.index_begin = uint32_t(indices.size());
+		indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+		entry.index_end = uint32_t(indices.size());
+		index.emplace_back(entry);
+		lod_sizes.emplace_back(mesh.lod_size);
+		for (Meshlet meshlet : mesh.meshlets) {
+			meshlet.index_begin += entry.index_begin;
+			meshlet.index_end += entry.index_begin;
+			//(quantized positions may be up to half a step from where the bounds were computed)
+			if (quantize) meshlet.radius += 0.5f * glm::length(bounds.back().max - bounds.back().min) / 65535.0f;
+			meshlets.emplace_back(meshlet);
+		}
+		if (mesh.lod_size != 0.0f) has_lods = true;
+		if (mesh.vertices.size() > 0x10000) small = false;
+	}
+
+	ChunkFileWriter writer;
+	if (quantize) writer.add("pnq0", quantized, compress);
+	else writer.add("pnct", data, compress);
+	if (small) {
+		std::vector< uint16_t > indices16(indices.begin(), indices.end());
+		writer.add("ix16", indices16, compress);
+	} else {
+		writer.add("ix32", indices, compress);
+	}
+	writer.add("str0", strings);
+	writer.add("idx1", index);
+	if (quantize) writer.add("bnd0", bounds);
+	if (has_lods) writer.add("lod0", lod_sizes);
+	if (!meshlets.empty()) writer.add("mlt0", meshlets);
+
+	std::ofstream out(filename, std::ios::binary);
+	writer.write(&out);
+	if (!out) throw std::runtime_error("Failed to write '" + filename + "'.");
+
+	std::cout << "Wrote " << meshes.size() << " meshes to '" << filename << "': "
+	          << data.size() + quantized.size() << " vertices ("
+	          << data.size() * sizeof(Vertex) + quantized.size() * sizeof(QuantizedVertex) << " bytes), "
+	          << indices.size() << " " << (small ? 16 : 32) << "-bit indices." << std::endl;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	std::string in_file, out_file;
+	bool compress = false;
+	bool optimize = true;
+	bool quantize = false;
+	uint32_t lods = 0;
+	float lod_error = 0.002f;
+	bool meshlets = false;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--compress") compress = true;
+		else if (arg == "--no-optimize") optimize = false;
+		else if (arg == "--quantize") quantize = true;
+		else if (arg == "--meshlets") meshlets = true;
+		else if (arg == "--lods" && i + 1 < argc) lods = uint32_t(std::stoul(argv[++i]));
+		else if (arg == "--lod-error" && i + 1 < argc) lod_error = std::stof(argv[++i]);
+		else if (in_file.empty()) in_file = arg;
+		else if (out_file.empty()) out_file = arg;
+		else in_file = "";
+	}
+	if (in_file.empty() || out_file.empty()) {
+		std::cerr << "Usage:\n\t./cook-meshes [--compress] [--no-optimize] [--quantize] [--lods N [--lod-error E]] [--meshlets] <in.pnct> <out.pnct>\n"
+		             "Welds duplicate vertices in each mesh and writes an indexed mesh file.\n"
+		             "Unless --no-optimize is given, also reorders triangles and vertices for the GPU's vertex cache.\n"
+		             "With --quantize, stores vertices in the compact 20-byte layout (16-bit positions, octahedral normals, half-float texcoords).\n"
+		             "With --lods N, also writes N simplified levels of detail (\"Name.lod1\", ...) of each mesh, halving the triangle count each time;\n"
+		             " each level is drawn once its error would be under E (default 0.002) of the viewport height.\n"
+		             "With --meshlets, also splits each mesh into meshlets (clusters of up to 128 triangles) for finer culling.\n"
+		             "(in and out may be the same file)" << std::endl;
+		return 1;
+	}
+
+	std::vector< CookMesh > meshes = read_meshes(in_file);
+
+	size_t before = 0, after = 0;
+	for (auto &mesh : meshes) {
+		before += mesh.vertices.size();
+		weld(&mesh);
+		after += mesh.vertices.size();
+	}
+	std::cout << "Welded " << before << " vertices down to " << after << "." << std::endl;
+
+	if (lods) {
+		//(replace any levels from a previous run)
+		meshes.erase(std::remove_if(meshes.begin(), meshes.end(), [](CookMesh const &mesh) {
+			return is_lod_name(mesh.name);
+		}), meshes.end());
+
+		std::cout << "Levels of detail (triangles, estimated error, projected size to switch at):\n";
+		size_t base_count = meshes.size();
+		for (size_t m = 0; m < base_count; ++m) {
+			if (meshes[m].indices.size() % 3 != 0 || meshes[m].indices.empty()) continue;
+			CookMesh const base = meshes[m];
+			glm::vec3 min = base.vertices[0].Position, max = base.vertices[0].Position;
+			for (auto const &v : base.vertices) {
+				min = glm::min(min, v.Position);
+				max = glm::max(max, v.Position);
+			}
+			float radius = 0.5f * glm::length(max - min);
+
+			std::cout << "  " << base.name << ": " << base.indices.size() / 3;
+			uint32_t previous = uint32_t(base.indices.size() / 3);
+			float previous_size = std::numeric_limits< float >::infinity();
+			for (uint32_t level = 1; level <= lods; ++level) {
+				float error = 0.0f;
+				CookMesh simplified = simplify(base, uint32_t(base.indices.size() / 3) >> level, &error);
+				uint32_t triangles = uint32_t(simplified.indices.size() / 3);
+				//(stop once simplification stalls -- e.g., on meshes that are all seams)
+				if (triangles == 0 || triangles > previous - previous / 5) break;
+				//the projected error is about error * size / radius (see Scene::draw_render_queue):
+				float size = (error > 0.0f ? lod_error * radius / error : std::numeric_limits< float >::infinity());
+				size = std::min(std::min(size, previous_size), 1000.0f);
+				simplified.name = base.name + ".lod" + std::to_string(level);
+				simplified.lod_size = size;
+				std::cout << " -> " << triangles << " (" << error << ", " << size << ")";
+				meshes.emplace_back(std::move(simplified));
+				previous = triangles;
+				previous_size = size;
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	if (optimize) {
+		std::cout << "Vertex cache (" << CacheSize << "-entry FIFO) misses per triangle (ACMR) and per vertex (ATVR):\n";
+		std::cout << std::fixed << std::setprecision(3);
+		for (auto &mesh : meshes) {
+			if (mesh.indices.size() % 3 != 0) {
+				std::cout << "  " << mesh.name << ": not a triangle list; skipped." << std::endl;
+				continue;
+			}
+			CacheStats old_stats = measure_cache(mesh);
+			std::vector< uint32_t > clusters = tipsify(&mesh);
+			reduce_overdraw(&mesh, clusters);
+			optimize_fetch(&mesh);
+			CacheStats new_stats = measure_cache(mesh);
+			std::cout << "  " << mesh.name << ": ACMR " << old_stats.acmr << " -> " << new_stats.acmr
+			          << ", ATVR " << old_stats.atvr << " -> " << new_stats.atvr << std::endl;
+		}
+	}
+
+	if (meshlets) {
+		size_t count = 0;
+		for (auto &mesh : meshes) {
+			if (mesh.indices.size() % 3 != 0) continue;
+			if (is_lod_name(mesh.name)) continue; //(Scene only culls meshlets of full-detail meshes)
+			build_meshlets(&mesh);
+			optimize_fetch(&mesh); //(triangles moved, so renumber vertices again)
+			count += mesh.meshlets.size();
+		}
+		std::cout << "Split meshes into " << count << " meshlets." << std::endl;
+	}
+
+	write_meshes(meshes, out_file, compress, quantize);
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
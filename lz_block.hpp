@@ -0,0 +1,164 @@
+#pragma once
+
+//Small, fast LZ77 block compressor / decompressor for chunk data (see read_write_chunk.hpp).
+// The compressed format is the LZ4 block format:
+//  a series of sequences, each:
+//   |token| <-- high four bits: literal count; low four bits: match length - 4 (15 => more length bytes follow)
+//   |ll|ll|..| <-- (only if literal count >= 15) bytes added to literal count; 255 => another byte follows
+//   |literals...|
+//   |of|fs| <-- little-endian match offset (distance back from current output position)
+//   |ml|ml|..| <-- (only if match length - 4 >= 15) bytes added to match length; 255 => another byte follows
+//  the final sequence has only literals; the last five bytes of a block are always literals.
+// Compression is a single greedy pass with a small hash table, so it is quick but not especially strong.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+//largest possible compressed size for 'size' input bytes:
+inline size_t lz_compress_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+//compress 'size' bytes from src into dst (which should hold lz_compress_bound(size) bytes):
+// returns compressed size, or 0 if it didn't fit in 'capacity'
+inline size_t lz_compress_block(char const *src, size_t size, char *dst, size_t capacity) {
+	enum : uint32_t {
+		MinMatch = 4,
+		LastLiterals = 5, //final bytes that are always literals
+		MatchSafety = 12, //matches must start at least this far before the end
+		HashBits = 12,
+		MaxOffset = 65535,
+	};
+	uint8_t const *in = reinterpret_cast< uint8_t const * >(src);
+	uint8_t *out = reinterpret_cast< uint8_t * >(dst);
+	uint8_t *out_end = out + capacity;
+
+	auto read32 = [](uint8_t const *p) {
+		uint32_t v;
+		std::memcpy(&v, p, 4);
+		return v;
+	};
+	auto hash = [](uint32_t v) {
+		return (v * 2654435761U) >> (32 - HashBits);
+	};
+
+	//writes a length's extension bytes (for lengths >= 15):
+	auto write_length = [&](size_t length) -> bool {
+		while (length >= 255) {
+			if (out == out_end) return false;
+			*(out++) = 255;
+			length -= 255;
+		}
+		if (out == out_end) return false;
+		*(out++) = uint8_t(length);
+		return true;
+	};
+	//writes a sequence of literals [from, to), followed by a match if match_length != 0:
+	auto write_sequence = [&](uint8_t const *from, uint8_t const *to, uint32_t offset, size_t match_length) -> bool {
+		size_t literals = to - from;
+		if (out == out_end) return false;
+		uint8_t *token = out++;
+		*token = uint8_t((literals >= 15 ? 15 : literals) << 4);
+		if (literals >= 15 && !write_length(literals - 15)) return false;
+		if (size_t(out_end - out) < literals) return false;
+		std::memcpy(out, from, literals);
+		out += literals;
+		if (match_length == 0) return true;
+		if (out_end - out < 2) return false;
+		*(out++) = uint8_t(offset & 0xff);
+		*(out++) = uint8_t(offset >> 8);
+		size_t extra = match_length - MinMatch;
+		*token |= uint8_t(extra >= 15 ? 15 : extra);
+		if (extra >= 15 && !write_length(extra - 15)) return false;
+		return true;
+	};
+
+	uint8_t const *anchor = in; //start of pending literals
+	if (size >= MatchSafety + 1) {
+		std::vector< uint32_t > table(1 << HashBits, 0xffffffffU);
+		uint8_t const *match_limit = in + size - MatchSafety; //matches may not start after this
+		uint8_t const *copy_limit = in + size - LastLiterals; //matches may not extend past this
+		uint8_t const *at = in;
+		while (at < match_limit) {
+			uint32_t v = read32(at);
+			uint32_t h = hash(v);
+			uint32_t candidate = table[h];
+			table[h] = uint32_t(at - in);
+			if (candidate == 0xffffffffU || uint32_t(at - in) - candidate > MaxOffset || read32(in + candidate) != v) {
+				++at;
+				continue;
+			}
+			uint8_t const *ref = in + candidate;
+			uint8_t const *end = at + MinMatch;
+			while (end < copy_limit && *end == ref[end - at]) ++end;
+			if (!write_sequence(anchor, at, uint32_t(at - ref), size_t(end - at))) return 0;
+			at = end;
+			anchor = at;
+		}
+	}
+	//trailing literals:
+	if (!write_sequence(anchor, in + size, 0, 0)) return 0;
+	return size_t(out - reinterpret_cast< uint8_t * >(dst));
+}
+
+//decompress a block produced by lz_compress_block into exactly dst_size bytes:
+// returns false if the data is malformed (never reads or writes out of bounds)
+inline bool lz_decompress_block(char const *src, size_t src_size, char *dst, size_t dst_size) {
+	uint8_t const *in = reinterpret_cast< uint8_t const * >(src);
+	uint8_t const *in_end = in + src_size;
+	uint8_t *out = reinterpret_cast< uint8_t * >(dst);
+	uint8_t *out_begin = out;
+	uint8_t *out_end = out + dst_size;
+
+	auto read_length = [&](size_t *length) -> bool {
+		uint8_t b;
+		do {
+			if (in == in_end) return false;
+			b = *(in++);
+			*length += b;
+		} while (b == 255);
+		return true;
+	};
+
+	//most literal runs and matches are short, so copy 8 bytes at a time when there is room to overrun by up to 7:
+	auto copy8 = [](uint8_t *to, uint8_t const *from, size_t count) {
+		for (size_t i = 0; i < count; i += 8) std::memcpy(to + i, from + i, 8);
+	};
+
+	while (in < in_end) {
+		uint8_t token = *(in++);
+		size_t literals = token >> 4;
+		if (literals == 15 && !read_length(&literals)) return false;
+		if (size_t(in_end - in) < literals || size_t(out_end - out) < literals) return false;
+		if (size_t(in_end - in) >= literals + 8 && size_t(out_end - out) >= literals + 8) copy8(out, in, literals);
+		else std::memcpy(out, in, literals);
+		in += literals;
+		out += literals;
+		if (in == in_end) break; //last sequence has no match
+
+		if (in_end - in < 2) return false;
+		size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+		in += 2;
+		size_t length = token & 0xf;
+		if (length == 15 && !read_length(&length)) return false;
+		length += 4;
+		if (offset == 0 || size_t(out - out_begin) < offset || size_t(out_end - out) < length) return false;
+		//matches may overlap their own output (offset < length repeats the last 'offset' bytes), so copy in
+		// runs that never overlap: each run starts a whole number of periods in, and the source doubles as it goes
+		uint8_t const *ref = out - offset;
+		if (offset >= 8 && size_t(out_end - out) >= length + 8) {
+			copy8(out, ref, length); //(each 8 bytes read are already written)
+		} else {
+			for (size_t copied = 0; copied < length; ) {
+				size_t run = std::min(length - copied, offset + copied);
+				std::memcpy(out + copied, ref, run);
+				copied += run;
+			}
+		}
+		out += length;
+	}
+	return out == out_end;
+}
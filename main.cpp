@@ -6,6 +6,7 @@
 
 //For asset loading:
 #include "Load.hpp"
+#include "GeometryArena.hpp"
 
 //GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
@@ -90,10 +91,22 @@ int main(int argc, char **argv) {
 	//SDL_ShowCursor(SDL_DISABLE);
 
 	//------------ load assets --------------
-	call_load_functions();
+	//keep handling window events while waiting on loaders running on worker threads, so the window stays responsive:
+	// (quitting cancels the loaders that haven't started yet; the game mode is only made if everything loaded)
+	bool loaded = call_load_functions([&](){
+		SDL_Event evt;
+		while (SDL_PollEvent(&evt) == 1) {
+			if (evt.type == SDL_QUIT) cancel_load_functions();
+		}
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		SDL_GL_SwapWindow(window);
+	});
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< TartMode >());
+	if (loaded) {
+		Mode::set_current(std::make_shared< TartMode >());
+	}
 
 	//------------ main loop ------------
 
@@ -175,6 +188,7 @@ int main(int argc, char **argv) {
 
 	//------------  teardown ------------
 
+	GeometryArena::delete_gl_objects(); //(meshes may outlive the context, but their buffers can't)
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
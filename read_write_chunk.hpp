@@ -1,15 +1,121 @@
 #pragma once
 
+#include "lz_block.hpp"
+#include "WorkerPool.hpp"
+
 #include <iostream>
+#include <streambuf>
+#include <string>
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
 // |ma|gi|c.|..| <-- four byte "magic number"
 // |sz|sz|sz|sz| <-- four byte (native endian) size
 // |TT...TT| * (sz/sizeof(TT)) <-- enough T structures to make up sz bytes
+//
+//Files may optionally start with a "toc0" chunk (a table of contents; see ChunkTocEntry below)
+// listing where every other chunk is; read_chunk skips it, while ChunkReader uses it for random access.
+//
+//Chunks may also be stored compressed (see below); readers decompress them transparently.
+
+//Compressed chunks have ChunkCompressed set in the header's size field; the other bits give the size of the stored data:
+// |rs|rs|rs|rs| <-- uncompressed size
+// |bs|bs|bs|bs| <-- block size (uncompressed; every block but the last is this big)
+// |bc|bc|bc|bc| <-- block count
+// |cs|cs|cs|cs| * bc <-- stored size of each block (== uncompressed size => block is stored as-is)
+// |...| <-- blocks, each compressed with lz_compress_block (see lz_block.hpp)
+//Blocks are independent, so they can be decompressed in parallel.
+enum : uint32_t {
+	ChunkCompressed = 0x80000000U,
+	ChunkBlockSize = 1U << 16,
+};
+
+//compress data into the stored format of a compressed chunk:
+inline std::vector< char > compress_chunk_data(char const *data, size_t size, uint32_t block_size = ChunkBlockSize) {
+	assert(block_size > 0);
+	uint32_t block_count = uint32_t((size + block_size - 1) / block_size);
+	std::vector< char > stored(4 * (3 + block_count));
+	uint32_t header[3] = { uint32_t(size), block_size, block_count };
+	std::memcpy(stored.data(), header, sizeof(header));
+
+	std::vector< char > block(lz_compress_bound(block_size));
+	for (uint32_t b = 0; b < block_count; ++b) {
+		size_t begin = size_t(b) * block_size;
+		size_t length = std::min< size_t >(block_size, size - begin);
+		size_t compressed = lz_compress_block(data + begin, length, block.data(), length - 1); //(only keep if smaller)
+		uint32_t stored_size;
+		if (compressed == 0) {
+			stored_size = uint32_t(length);
+			stored.insert(stored.end(), data + begin, data + begin + length);
+		} else {
+			stored_size = uint32_t(compressed);
+			stored.insert(stored.end(), block.data(), block.data() + compressed);
+		}
+		std::memcpy(stored.data() + 4 * (3 + b), &stored_size, 4);
+	}
+	return stored;
+}
+
+//uncompressed size of a compressed chunk's stored data:
+inline size_t compressed_chunk_size(char const *stored, size_t stored_size) {
+	uint32_t raw_size = 0;
+	if (stored_size < 12) throw std::runtime_error("Compressed chunk is missing its header");
+	std::memcpy(&raw_size, stored, 4);
+	return raw_size;
+}
+
+//decompress a compressed chunk's stored data into 'out' (which holds compressed_chunk_size() bytes):
+// blocks are decoded on WorkerPool::shared() if 'parallel' is set; throws on malformed data
+inline void decompress_chunk_data(char const *stored, size_t stored_size, char *out, bool parallel) {
+	uint32_t header[3];
+	if (stored_size < sizeof(header)) throw std::runtime_error("Compressed chunk is missing its header");
+	std::memcpy(header, stored, sizeof(header));
+	uint32_t raw_size = header[0], block_size = header[1], block_count = header[2];
+	if (block_size == 0 || block_count != (uint64_t(raw_size) + block_size - 1) / block_size
+	 || stored_size < 4 * (3 + uint64_t(block_count))) {
+		throw std::runtime_error("Compressed chunk has a malformed header");
+	}
+
+	//find where each block starts:
+	std::vector< size_t > starts(block_count + 1);
+	starts[0] = 4 * (3 + size_t(block_count));
+	for (uint32_t b = 0; b < block_count; ++b) {
+		uint32_t block_stored;
+		std::memcpy(&block_stored, stored + 4 * (3 + b), 4);
+		starts[b+1] = starts[b] + block_stored;
+	}
+	if (starts[block_count] != stored_size) {
+		throw std::runtime_error("Compressed chunk block sizes don't match chunk size");
+	}
+
+	std::vector< char > failed(block_count, 0); //(not vector< bool >, since workers write it concurrently)
+	auto decode = [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; ++b) {
+			size_t out_begin = b * block_size;
+			size_t length = std::min< size_t >(block_size, raw_size - out_begin);
+			size_t in_length = starts[b+1] - starts[b];
+			if (in_length == length) {
+				std::memcpy(out + out_begin, stored + starts[b], length);
+			} else if (!lz_decompress_block(stored + starts[b], in_length, out + out_begin, length)) {
+				failed[b] = 1;
+			}
+		}
+	};
+	if (parallel) {
+		WorkerPool::shared().parallel_for(block_count, 4, decode);
+	} else {
+		decode(0, block_count);
+	}
+	if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+		throw std::runtime_error("Compressed chunk contains a malformed block");
+	}
+}
 
 template< typename T >
 void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *to_) {
@@ -26,10 +132,30 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 	if (!from.read(reinterpret_cast< char * >(&header), sizeof(header))) {
 		throw std::runtime_error("Failed to read chunk header");
 	}
+	if (std::string(header.magic,4) == "toc0" && magic != "toc0") {
+		//skip table of contents (only useful for random access):
+		if (!from.seekg(header.size, std::ios::cur) || !from.read(reinterpret_cast< char * >(&header), sizeof(header))) {
+			throw std::runtime_error("Failed to read chunk header");
+		}
+	}
 	if (std::string(header.magic,4) != magic) {
 		throw std::runtime_error("Unexpected magic number in chunk");
 	}
 
+	if (header.size & ChunkCompressed) {
+		std::vector< char > stored(header.size & ~ChunkCompressed);
+		if (!from.read(stored.data(), stored.size())) {
+			throw std::runtime_error("Failed to read chunk data.");
+		}
+		size_t size = compressed_chunk_size(stored.data(), stored.size());
+		if (size % sizeof(T) != 0) {
+			throw std::runtime_error("Size of chunk not divisible by element size");
+		}
+		to.resize(size / sizeof(T));
+		decompress_chunk_data(stored.data(), stored.size(), reinterpret_cast< char * >(to.data()), false);
+		return;
+	}
+
 	if (header.size % sizeof(T) != 0) {
 		throw std::runtime_error("Size of chunk not divisible by element size");
 	}
@@ -63,3 +189,296 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+//..same, but compressed:
+template< typename T >
+void write_compressed_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to_) {
+	assert(magic.size() == 4);
+	assert(to_);
+	std::vector< char > stored = compress_chunk_data(reinterpret_cast< char const * >(from.data()), from.size() * sizeof(T));
+	uint32_t size = uint32_t(stored.size()) | ChunkCompressed;
+	to_->write(magic.data(), 4);
+	to_->write(reinterpret_cast< const char * >(&size), 4);
+	to_->write(stored.data(), stored.size());
+}
+
+
+//Table of contents:
+// a "toc0" chunk at the start of a file holds one entry per other chunk in the file (in file order):
+struct ChunkTocEntry {
+	char magic[4];
+	uint32_t offset; //offset of the chunk's header from the start of the file
+	uint32_t size; //size of the chunk's data (as in its header)
+	uint32_t checksum; //chunk_checksum() of the chunk's data
+};
+static_assert(sizeof(ChunkTocEntry) == 16, "ChunkTocEntry is packed");
+
+//CRC-32 (as in zlib, so python exporters can use zlib.crc32):
+inline uint32_t chunk_checksum(char const *data, size_t size) {
+	static uint32_t const *table = [](){
+		static uint32_t t[256];
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (uint32_t k = 0; k < 8; ++k) {
+				c = (c & 1) ? (0xedb88320U ^ (c >> 1)) : (c >> 1);
+			}
+			t[i] = c;
+		}
+		return t;
+	}();
+	uint32_t crc = 0xffffffffU;
+	for (size_t i = 0; i < size; ++i) {
+		crc = table[(crc ^ uint8_t(data[i])) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffU;
+}
+
+//collects chunks, then writes them after a table of contents:
+struct ChunkFileWriter {
+	//add a chunk (optionally compressed -- worthwhile for big chunks, like vertex data):
+	template< typename T >
+	void add(std::string const &magic, std::vector< T > const &from, bool compress = false) {
+		assert(magic.size() == 4);
+		char const *bytes = reinterpret_cast< char const * >(from.data());
+		size_t size = from.size() * sizeof(T);
+		chunks.emplace_back();
+		chunks.back().magic = magic;
+		chunks.back().compressed = compress;
+		if (compress) chunks.back().stored = compress_chunk_data(bytes, size);
+		else chunks.back().stored.assign(bytes, bytes + size);
+	}
+
+	void write(std::ostream *to) const {
+		assert(to);
+		std::vector< ChunkTocEntry > toc;
+		uint32_t offset = uint32_t(8 + chunks.size() * sizeof(ChunkTocEntry)); //first chunk follows the toc0 chunk
+		for (auto const &chunk : chunks) {
+			ChunkTocEntry entry;
+			std::memcpy(entry.magic, chunk.magic.data(), 4);
+			entry.offset = offset;
+			entry.size = uint32_t(chunk.stored.size());
+			entry.checksum = chunk_checksum(chunk.stored.data(), chunk.stored.size());
+			toc.emplace_back(entry);
+			offset += 8 + entry.size;
+		}
+		write_chunk("toc0", toc, to);
+		for (auto const &chunk : chunks) {
+			uint32_t size = uint32_t(chunk.stored.size()) | (chunk.compressed ? ChunkCompressed : 0);
+			to->write(chunk.magic.data(), 4);
+			to->write(reinterpret_cast< const char * >(&size), 4);
+			to->write(chunk.stored.data(), chunk.stored.size());
+		}
+	}
+
+	struct Chunk {
+		std::string magic;
+		bool compressed = false;
+		std::vector< char > stored; //data as written to the file (i.e., compressed if 'compressed')
+	};
+	std::vector< Chunk > chunks;
+};
+
+
+//Zero-copy reading: a ChunkReader walks chunks in a block of memory (e.g., a MappedFile) and
+// returns ChunkViews that point straight at the chunk data, rather than copying it into vectors.
+
+//read-only view of the array of T's in a chunk (supports the parts of the std::vector interface loaders use):
+template< typename T >
+struct ChunkView {
+	T const *data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T const &operator[](size_t i) const { assert(i < count); return ptr[i]; }
+	T const *begin() const { return ptr; }
+	T const *end() const { return ptr + count; }
+
+	ChunkView() = default;
+	ChunkView(ChunkView &&) = default; //(moving 'storage' keeps its data pointer, so 'ptr' stays valid)
+	ChunkView &operator=(ChunkView &&) = default;
+	ChunkView(ChunkView const &) = delete;
+	ChunkView &operator=(ChunkView const &) = delete;
+
+	//-- internals --
+	T const *ptr = nullptr;
+	size_t count = 0;
+	std::vector< T > storage; //only used if the chunk is compressed or its data isn't aligned well enough to use in place
+};
+
+struct ChunkReader {
+	//if the data starts with a table of contents, it is read (and checked) here:
+	// note: will throw on format errors
+	ChunkReader(char const *begin, char const *end);
+
+	//read the next chunk, which must have the given magic number:
+	// (with a table of contents, this is the next chunk with that magic, wherever it is, so chunks can be skipped)
+	// note: will throw on format errors, like read_chunk
+	template< typename T >
+	ChunkView< T > read_chunk(std::string const &magic);
+
+	//random access (needs a table of contents) -- find a chunk without affecting read_chunk:
+	// (doesn't modify the reader, so may be called from several threads at once)
+	bool has_chunk(std::string const &magic) const;
+	template< typename T >
+	ChunkView< T > lookup_chunk(std::string const &magic, uint32_t nth = 0) const; //nth chunk with magic; throws if missing
+
+	//is there more data after the chunks read so far?
+	bool at_end() const { return at == end; }
+
+	//would read_chunk(magic) succeed? (for files whose chunks vary, e.g., optional chunks)
+	// (with a table of contents: is there an unread chunk with that magic; otherwise: does the next chunk have it)
+	bool next_chunk_is(std::string const &magic) const;
+
+	//verify chunk_checksum() when reading chunks listed in the table of contents:
+	// (off by default, since it reads every byte of every chunk; tools like cook-meshes turn it on)
+	bool verify_checksums = false;
+
+	//decompress compressed chunks' blocks on WorkerPool::shared():
+	// (with a memory-mapped file, this also spreads the page faults that read the file across threads)
+	bool parallel_decode = true;
+
+	//-- internals --
+	char const *begin;
+	char const *end;
+	char const *at; //end of furthest chunk read so far (i.e., start of next chunk when reading in order)
+	std::vector< ChunkTocEntry > toc; //(empty if the file has no table of contents)
+	std::vector< bool > toc_read; //which toc entries read_chunk has returned
+
+	//parse the chunk starting at 'from', which must have the given magic number:
+	template< typename T >
+	ChunkView< T > chunk_at(char const *from, std::string const &magic, char const **after) const;
+};
+
+inline ChunkReader::ChunkReader(char const *begin_, char const *end_) : begin(begin_), end(end_), at(begin_) {
+	if (size_t(end - begin) >= 8 && std::memcmp(begin, "toc0", 4) == 0) {
+		ChunkView< ChunkTocEntry > view = chunk_at< ChunkTocEntry >(begin, "toc0", &at);
+		toc.assign(view.begin(), view.end());
+		toc_read.assign(toc.size(), false);
+		for (auto const &entry : toc) {
+			if (entry.offset < 8 || size_t(end - begin) < size_t(entry.offset) + 8 + size_t(entry.size)) {
+				throw std::runtime_error("Table of contents lists chunk outside of file");
+			}
+			//(the entry must describe the chunk that is actually there, so checksums cover the right bytes)
+			uint32_t size = 0;
+			std::memcpy(&size, begin + entry.offset + 4, 4);
+			if (std::memcmp(begin + entry.offset, entry.magic, 4) != 0 || (size & ~ChunkCompressed) != entry.size) {
+				throw std::runtime_error("Table of contents entry doesn't match chunk header");
+			}
+		}
+	}
+}
+
+inline bool ChunkReader::has_chunk(std::string const &magic) const {
+	for (auto const &entry : toc) {
+		if (std::string(entry.magic, 4) == magic) return true;
+	}
+	return false;
+}
+
+inline bool ChunkReader::next_chunk_is(std::string const &magic) const {
+	assert(magic.size() == 4);
+	if (toc.empty()) {
+		return size_t(end - at) >= 8 && std::memcmp(at, magic.data(), 4) == 0;
+	}
+	for (uint32_t i = 0; i < toc.size(); ++i) {
+		if (!toc_read[i] && std::string(toc[i].magic, 4) == magic) return true;
+	}
+	return false;
+}
+
+template< typename T >
+ChunkView< T > ChunkReader::chunk_at(char const *from, std::string const &magic, char const **after) const {
+	assert(magic.size() == 4);
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (size_t(end - from) < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, from, sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+	bool compressed = (header.size & ChunkCompressed) != 0;
+	header.size &= ~ChunkCompressed;
+	if (size_t(end - from) - sizeof(header) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+	char const *data = from + sizeof(header);
+	if (after) *after = data + header.size;
+
+	ChunkView< T > view;
+	if (compressed) {
+		size_t size = compressed_chunk_size(data, header.size);
+		if (size % sizeof(T) != 0) {
+			throw std::runtime_error("Size of chunk not divisible by element size");
+		}
+		view.count = size / sizeof(T);
+		view.storage.resize(view.count);
+		decompress_chunk_data(data, header.size, reinterpret_cast< char * >(view.storage.data()), parallel_decode);
+		view.ptr = view.storage.data();
+		return view;
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	view.count = header.size / sizeof(T);
+	if (reinterpret_cast< uintptr_t >(data) % alignof(T) == 0) {
+		view.ptr = reinterpret_cast< T const * >(data);
+	} else {
+		//(e.g., a chunk following a string chunk whose length isn't a multiple of 4)
+		view.storage.resize(view.count);
+		std::memcpy(static_cast< void * >(view.storage.data()), data, header.size);
+		view.ptr = view.storage.data();
+	}
+	return view;
+}
+
+template< typename T >
+ChunkView< T > ChunkReader::lookup_chunk(std::string const &magic, uint32_t nth) const {
+	for (auto const &entry : toc) {
+		if (std::string(entry.magic, 4) != magic) continue;
+		if (nth > 0) {
+			--nth;
+			continue;
+		}
+		if (verify_checksums && chunk_checksum(begin + entry.offset + 8, entry.size) != entry.checksum) {
+			throw std::runtime_error("Checksum mismatch in chunk '" + magic + "'");
+		}
+		return chunk_at< T >(begin + entry.offset, magic, nullptr);
+	}
+	throw std::runtime_error("Chunk '" + magic + "' not found in table of contents");
+}
+
+template< typename T >
+ChunkView< T > ChunkReader::read_chunk(std::string const &magic) {
+	if (toc.empty()) {
+		return chunk_at< T >(at, magic, &at);
+	}
+	for (uint32_t i = 0; i < toc.size(); ++i) {
+		ChunkTocEntry const &entry = toc[i];
+		if (toc_read[i] || std::string(entry.magic, 4) != magic) continue;
+		toc_read[i] = true;
+		if (verify_checksums && chunk_checksum(begin + entry.offset + 8, entry.size) != entry.checksum) {
+			throw std::runtime_error("Checksum mismatch in chunk '" + magic + "'");
+		}
+		char const *after = nullptr;
+		ChunkView< T > view = chunk_at< T >(begin + entry.offset, magic, &after);
+		at = std::max(at, after);
+		return view;
+	}
+	throw std::runtime_error("Chunk '" + magic + "' not found in table of contents");
+}
+
+//std::streambuf over a block of memory, so stream-based readers can continue where a ChunkReader left off:
+struct MemoryStreambuf : std::streambuf {
+	MemoryStreambuf(char const *begin, char const *end) {
+		char *b = const_cast< char * >(begin); //(streambuf wants non-const pointers, but get areas are never written)
+		setg(b, b, b + (end - begin));
+	}
+};
@@ -38,6 +38,7 @@ else:
 print(" of '" + infile + "' to '" + outfile + "'.")
 
 import struct
+import zlib
 
 bpy.ops.wm.open_mainfile(filepath=infile)
 
@@ -198,18 +199,18 @@ assert(vertex_count * (4*3+4*3+1*4+4*2) == len(data))
 
 #write the data chunk and index chunk to an output blob:
 blob = open(outfile, 'wb')
-#first chunk: the data
-blob.write(struct.pack('4s',b'pnct')) #type
-blob.write(struct.pack('I', len(data))) #length
-blob.write(data)
-#second chunk: the strings
-blob.write(struct.pack('4s',b'str0')) #type
-blob.write(struct.pack('I', len(strings))) #length
-blob.write(strings)
-#third chunk: the index
-blob.write(struct.pack('4s',b'idx0')) #type
-blob.write(struct.pack('I', len(index))) #length
-blob.write(index)
+#chunks, in order: the data, the strings, the index
+chunks = [(b'pnct', data), (b'str0', strings), (b'idx0', index)]
+#table of contents first (magic, offset, size, crc32 of each chunk -- see read_write_chunk.hpp):
+toc = b''
+offset = 8 + 16 * len(chunks)
+for (magic, chunk) in chunks:
+	toc += struct.pack('4sIII', magic, offset, len(chunk), zlib.crc32(chunk) & 0xffffffff)
+	offset += 8 + len(chunk)
+for (magic, chunk) in [(b'toc0', toc)] + chunks:
+	blob.write(struct.pack('4s',magic)) #type
+	blob.write(struct.pack('I', len(chunk))) #length
+	blob.write(chunk)
 wrote = blob.tell()
 blob.close()
 
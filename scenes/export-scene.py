@@ -36,6 +36,7 @@ print(" of '" + infile + "' to '" + outfile + "'.")
 import bpy
 import mathutils
 import struct
+import zlib
 import math
 
 #---------------------------------------------------------------------
@@ -220,11 +221,22 @@ def write_chunk(magic, data):
 	blob.write(struct.pack('I', len(data))) #length
 	blob.write(data)
 
-write_chunk(b'str0', strings_data)
-write_chunk(b'xfh0', xfh_data)
-write_chunk(b'msh0', mesh_data)
-write_chunk(b'cam0', camera_data)
-write_chunk(b'lmp0', lamp_data)
+chunks = [
+	(b'str0', strings_data),
+	(b'xfh0', xfh_data),
+	(b'msh0', mesh_data),
+	(b'cam0', camera_data),
+	(b'lmp0', lamp_data),
+]
+#table of contents first (magic, offset, size, crc32 of each chunk -- see read_write_chunk.hpp):
+toc = b''
+offset = 8 + 16 * len(chunks)
+for (magic, data) in chunks:
+	toc += struct.pack('4sIII', magic, offset, len(data), zlib.crc32(data) & 0xffffffff)
+	offset += 8 + len(data)
+write_chunk(b'toc0', toc)
+for (magic, data) in chunks:
+	write_chunk(magic, data)
 
 print("Wrote " + str(blob.tell()) + " bytes to '" + outfile + "'")
 blob.close()
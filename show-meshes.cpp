@@ -1,6 +1,7 @@
 #include "Mode.hpp"
 #include "ShowMeshesMode.hpp"
 #include "Load.hpp"
+#include "GeometryArena.hpp"
 #include "GL.hpp"
 #include "load_save_png.hpp"
 
@@ -180,6 +181,7 @@ int main(int argc, char **argv) {
 
 
 	//------------  teardown ------------
+	GeometryArena::delete_gl_objects(); //(meshes may outlive the context, but their buffers can't)
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
@@ -1,6 +1,7 @@
 #include "Mode.hpp"
 #include "ShowSceneMode.hpp"
 #include "Load.hpp"
+#include "GeometryArena.hpp"
 #include "GL.hpp"
 #include "load_save_png.hpp"
 #include "ShowSceneProgram.hpp"
@@ -120,6 +121,21 @@ int main(int argc, char **argv) {
 				drawable.pipeline.type = mesh.type;
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
+				drawable.pipeline.index_type = mesh.index_type;
+				drawable.pipeline.index_start = mesh.index_start;
+				drawable.pipeline.dequantize = mesh.dequantize;
+				drawable.pipeline.meshlets = mesh.meshlets;
+				drawable.pipeline.meshlet_count = mesh.meshlet_count;
+				for (uint32_t l = 0; l < mesh.lods.size() && l < Scene::Drawable::Pipeline::MaxLODs; ++l) {
+					drawable.pipeline.lods[l].start = mesh.lods[l].start;
+					drawable.pipeline.lods[l].count = mesh.lods[l].count;
+					drawable.pipeline.lods[l].index_start = mesh.lods[l].index_start;
+					drawable.pipeline.lods[l].dequantize = mesh.lods[l].dequantize;
+					drawable.pipeline.lods[l].max_size = mesh.lods[l].max_size;
+				}
+
+				drawable.min = mesh.min;
+				drawable.max = mesh.max;
 
 			});
 		} catch (std::exception &e) {
@@ -222,6 +238,7 @@ int main(int argc, char **argv) {
 
 
 	//------------  teardown ------------
+	GeometryArena::delete_gl_objects(); //(meshes may outlive the context, but their buffers can't)
 	SDL_GL_DeleteContext(context);
 	context = 0;
 